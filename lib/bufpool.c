@@ -0,0 +1,175 @@
+/***********************************************************************************/
+/*  bufpool.c - reusable buffers for the file transfers                            */
+/*  Copyright (C) 1998-2007 Brian Masney <masneyb@gftp.org>                        */
+/*                                                                                 */
+/*  Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/*  of this software and associated documentation files (the "Software"), to deal  */
+/*  in the Software without restriction, including without limitation the rights   */
+/*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/*  copies of the Software, and to permit persons to whom the Software is          */
+/*  furnished to do so, subject to the following conditions:                       */
+/*                                                                                 */
+/*  The above copyright notice and this permission notice shall be included in all */
+/*  copies or substantial portions of the Software.                                */
+/*                                                                                 */
+/*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/*  SOFTWARE.                                                                      */
+/***********************************************************************************/
+
+
+#include "gftp.h"
+
+/* The buffers that hold the file data are taken from a pool instead of a
+   g_malloc0() and g_free() for every file. Each thread keeps its own pool,
+   so taking a buffer needs no lock, and hands the buffers back to the
+   system when it exits. The sizes are rounded up to a power of two and the
+   buffers are page aligned, so that they can be used with O_DIRECT. Larger
+   buffers than GFTP_BUFFER_MAX_SHIFT allows aren't kept. */
+
+#define GFTP_BUFFER_ALIGN     4096
+#define GFTP_BUFFER_MIN_SHIFT 12
+#define GFTP_BUFFER_MAX_SHIFT 24
+#define GFTP_BUFFER_CLASSES   (GFTP_BUFFER_MAX_SHIFT - GFTP_BUFFER_MIN_SHIFT + 1)
+#define GFTP_BUFFER_POOL_KEEP 4  /* Free buffers kept of each size */
+
+typedef struct gftp_buffer_pool_tag
+{
+  char *free[GFTP_BUFFER_CLASSES][GFTP_BUFFER_POOL_KEEP];
+  int num_free[GFTP_BUFFER_CLASSES];
+} gftp_buffer_pool;
+
+static void gftp_buffer_pool_free (gpointer data);
+
+static GPrivate gftp_buffer_pool_key = G_PRIVATE_INIT (gftp_buffer_pool_free);
+static volatile gint gftp_buffer_allocated = 0;
+static volatile gint gftp_buffer_reused = 0;
+static volatile gint gftp_buffer_released = 0;
+
+
+static void
+gftp_buffer_pool_free (gpointer data)
+{
+  gftp_buffer_pool * pool;
+  int i, j;
+
+  pool = data;
+  for (i = 0; i < GFTP_BUFFER_CLASSES; i++)
+    for (j = 0; j < pool->num_free[i]; j++)
+      {
+        free (pool->free[i][j]);
+        g_atomic_int_inc (&gftp_buffer_released);
+      }
+
+  g_free (pool);
+}
+
+
+static gftp_buffer_pool *
+gftp_buffer_get_pool (void)
+{
+  gftp_buffer_pool * pool;
+
+  if ((pool = g_private_get (&gftp_buffer_pool_key)) == NULL)
+    {
+      pool = g_malloc0 (sizeof (*pool));
+      g_private_set (&gftp_buffer_pool_key, pool);
+    }
+
+  return (pool);
+}
+
+
+/* Returns the size class of a buffer of size bytes, or -1 if it is too
+   large to be kept. The size that is really allocated is stored in
+   bufsize */
+
+static int
+gftp_buffer_class (size_t size, size_t * bufsize)
+{
+  int shift;
+
+  for (shift = GFTP_BUFFER_MIN_SHIFT; shift <= GFTP_BUFFER_MAX_SHIFT; shift++)
+    {
+      if (size <= ((size_t) 1 << shift))
+        {
+          *bufsize = (size_t) 1 << shift;
+          return (shift - GFTP_BUFFER_MIN_SHIFT);
+        }
+    }
+
+  *bufsize = (size + GFTP_BUFFER_ALIGN - 1) & ~((size_t) GFTP_BUFFER_ALIGN - 1);
+  return (-1);
+}
+
+
+/* Returns a page aligned buffer of at least size bytes. The buffer isn't
+   cleared. It has to be given back with gftp_buffer_put() and the same
+   size */
+
+char *
+gftp_buffer_get (size_t size)
+{
+  gftp_buffer_pool * pool;
+  size_t bufsize;
+  void *buf;
+  int class;
+
+  class = gftp_buffer_class (size, &bufsize);
+  if (class >= 0)
+    {
+      pool = gftp_buffer_get_pool ();
+      if (pool->num_free[class] > 0)
+        {
+          g_atomic_int_inc (&gftp_buffer_reused);
+          return (pool->free[class][--pool->num_free[class]]);
+        }
+    }
+
+  /* Fail the same way g_malloc() does */
+  if (posix_memalign (&buf, GFTP_BUFFER_ALIGN, bufsize) != 0)
+    g_error ("%s: failed to allocate %lu bytes", G_STRLOC,
+             (unsigned long) bufsize);
+
+  g_atomic_int_inc (&gftp_buffer_allocated);
+  return (buf);
+}
+
+
+void
+gftp_buffer_put (char *buf, size_t size)
+{
+  gftp_buffer_pool * pool;
+  size_t bufsize;
+  int class;
+
+  if (buf == NULL)
+    return;
+
+  class = gftp_buffer_class (size, &bufsize);
+  if (class >= 0)
+    {
+      pool = gftp_buffer_get_pool ();
+      if (pool->num_free[class] < GFTP_BUFFER_POOL_KEEP)
+        {
+          pool->free[class][pool->num_free[class]++] = buf;
+          return;
+        }
+    }
+
+  free (buf);
+  g_atomic_int_inc (&gftp_buffer_released);
+}
+
+
+void
+gftp_get_buffer_pool_stats (gftp_buffer_pool_stats * stats)
+{
+  stats->allocated = g_atomic_int_get (&gftp_buffer_allocated);
+  stats->reused = g_atomic_int_get (&gftp_buffer_reused);
+  stats->released = g_atomic_int_get (&gftp_buffer_released);
+}
@@ -21,85 +21,249 @@
 /*  SOFTWARE.                                                                      */
 /***********************************************************************************/
 
+
 #include "gftp.h"
 
+/* Each directory listing is kept in its own file in the cache directory.
+   The file is named after the SHA1 of the cache description, so a lookup
+   is a single open() instead of a scan of an index. A new listing is
+   written to a temporary file that is renamed over the entry when the
+   listing is complete, so other gftp processes never see half of it.
+
+   The first line of an entry holds the description and the expiration
+   date. It is followed by the files of the listing as they were returned
+   by gftp_get_next_file(): a gftp_cache_record followed by the NUL
+   terminated file, user and group names. Reading a cached listing back is
+   a walk over the mmap()ed entry, there is nothing left to parse or to
+   convert to UTF-8. The records are in host byte order, the cache is not
+   meant to be shared between machines. The modification time of the file
+   is bumped each time the entry is used and serves as the last access time
+   when the cache has to be trimmed down to cache_max_entries. */
+
+#define GFTP_CACHE_KEY_LEN    40 /* SHA1 in hex */
+#define GFTP_CACHE_TMP_SUFFIX ".XXXXXX"
+
 struct gftp_cache_entry_tag
 {
-  char *url,
-       *file;
+  char *url;
   time_t expiration_date;
-
-  char *pos1,
-       *pos2,
-       *pos3;
+  size_t header_len;
 };
   
 typedef struct gftp_cache_entry_tag gftp_cache_entry;
 
+struct gftp_cache_lru_tag
+{
+  char *file;
+  time_t last_used;
+};
+
+typedef struct gftp_cache_lru_tag gftp_cache_lru;
+
+#define GFTP_CACHE_FILE_UTF8 0x1
+
+struct gftp_cache_record_tag
+{
+  gint64 datetime;
+  gint64 size;
+  guint32 st_mode;
+  guint32 flags;
+  guint32 file_len;  /* The lengths include the NUL */
+  guint32 user_len;
+  guint32 group_len;
+  guint32 reserved;
+};
+
+typedef struct gftp_cache_record_tag gftp_cache_record;
+
+static WGMutex gftp_cache_mutex;
+static long gftp_cache_num_entries = -1; /* Not counted yet */
+
+
+static char *
+gftp_get_cache_dir (void)
+{
+  return (g_strconcat (BASE_CONF_DIR, "/cache", NULL));
+}
+
+
+static char *
+gftp_get_cache_file (const char *cachedir, const char *description)
+{
+  char *key, *ret;
+
+  key = g_compute_checksum_for_string (G_CHECKSUM_SHA1, description, -1);
+  ret = g_strdup_printf ("%s/%s", cachedir, key);
+  g_free (key);
+
+  return (ret);
+}
+
+
+static int
+gftp_is_cache_file (const char *name)
+{
+  int i;
+
+  for (i = 0; i < GFTP_CACHE_KEY_LEN; i++)
+    {
+      if (!isxdigit ((unsigned char) name[i]))
+        return (0);
+    }
+
+  return (name[i] == '\0');
+}
+
 
 static int
-gftp_parse_cache_line (gftp_request * request, /*@out@*/ gftp_cache_entry * centry, 
-                       char *line)
+gftp_read_cache_header (gftp_request * request, 
+                        /*@out@*/ gftp_cache_entry * centry,
+                        char *buf, size_t buflen, int fd)
 {
-  char *pos;
+  char *pos, *tab;
+  ssize_t len;
 
   memset (centry, 0, sizeof (*centry));
 
-  if ((pos = strchr (line, '\t')) == NULL || *(pos + 1) == '\0')
+  if ((len = pread (fd, buf, buflen - 1, 0)) <= 0)
+    return (-1);
+
+  buf[len] = '\0';
+  if ((pos = strchr (buf, '\n')) == NULL ||
+      (tab = strrchr (buf, '\t')) == NULL || tab > pos)
     {
       if (request != NULL)
         request->logging_function (gftp_logging_error, request,
                             _("Error: Invalid line %s in cache index file\n"), 
-                            line);
+                            buf);
       return (-1);
     }
 
-  centry->pos1 = pos;
-  *pos++ = '\0';
-  centry->url = line;
-  centry->file = pos;
-  
-  if ((pos = strchr (pos, '\t')) == NULL || *(pos + 1) == '\0')
+  *pos = '\0';
+  *tab = '\0';
+  centry->url = buf;
+  centry->expiration_date = strtol (tab + 1, NULL, 10);
+  centry->header_len = pos - buf + 1;
+
+  return (0);
+}
+
+
+static GList *
+gftp_list_cache_files (const char *cachedir)
+{
+  gftp_cache_lru * lru;
+  struct dirent * dirent;
+  struct stat st;
+  GList * ret;
+  char *file;
+  DIR * dir;
+
+  if ((dir = opendir (cachedir)) == NULL)
+    return (NULL);
+
+  ret = NULL;
+  while ((dirent = readdir (dir)) != NULL)
     {
-      if (request != NULL)
-        request->logging_function (gftp_logging_error, request,
-                            _("Error: Invalid line %s in cache index file\n"), 
-                            line);
-      return (-1);
+      if (!gftp_is_cache_file (dirent->d_name))
+        continue;
+
+      file = g_strdup_printf ("%s/%s", cachedir, dirent->d_name);
+      if (stat (file, &st) != 0)
+        {
+          g_free (file);
+          continue;
+        }
+
+      lru = g_malloc0 (sizeof (*lru));
+      lru->file = file;
+      lru->last_used = st.st_mtime;
+      ret = g_list_prepend (ret, lru);
     }
 
-  centry->pos2 = pos;
-  *pos++ = '\0';
-  //centry->server_type = strtol (pos, NULL, 10);
+  closedir (dir);
+  return (ret);
+}
+
 
-  if ((pos = strchr (pos, '\t')) == NULL || *(pos + 1) == '\0')
+static gint
+gftp_cache_lru_compare (gconstpointer a, gconstpointer b)
+{
+  const gftp_cache_lru * lru1, * lru2;
+
+  lru1 = a;
+  lru2 = b;
+  if (lru1->last_used < lru2->last_used)
+    return (-1);
+  else if (lru1->last_used > lru2->last_used)
+    return (1);
+  else
+    return (0);
+}
+
+
+/* Removes the entries that have expired and, when there are more than
+   max_entries left, the least recently used ones. Called with
+   gftp_cache_mutex held. Returns the number of entries left */
+static long
+gftp_trim_cache (const char *cachedir, long max_entries, intptr_t cache_ttl)
+{
+  GList * files, * templist;
+  gftp_cache_lru * lru;
+  long num_entries;
+  time_t now;
+
+  time (&now);
+  files = g_list_sort (gftp_list_cache_files (cachedir),
+                       gftp_cache_lru_compare);
+
+  num_entries = g_list_length (files);
+  for (templist = files; templist != NULL; templist = templist->next)
     {
-      if (request != NULL)
-        request->logging_function (gftp_logging_error, request,
-                            _("Error: Invalid line %s in cache index file\n"), 
-                            line);
-      return (-1);
-    }
+      lru = templist->data;
 
-  centry->pos3 = pos;
-  *pos++ = '\0';
-  centry->expiration_date = strtol (pos, NULL, 10);
+      /* An entry that was last used more than cache_ttl seconds ago has
+         expired, there is no need to read it */
+      if ((max_entries > 0 && num_entries > max_entries) ||
+          lru->last_used + cache_ttl < now)
+        {
+          if (unlink (lru->file) == 0)
+            num_entries--;
+        }
 
-  return (0);
+      g_free (lru->file);
+      g_free (lru);
+    }
+
+  g_list_free (files);
+  return (num_entries);
 }
 
 
 static void
-gftp_restore_cache_line (gftp_cache_entry * centry)
+gftp_count_new_cache_entry (gftp_request * request, const char *cachedir)
 {
-  if (centry->pos1 != NULL)
-    *centry->pos1 = '\t';
+  intptr_t cache_max_entries, cache_ttl;
+
+  gftp_lookup_request_option (request, "cache_max_entries",
+                              &cache_max_entries);
+  gftp_lookup_request_option (request, "cache_ttl", &cache_ttl);
+
+  g_mutex_lock (&gftp_cache_mutex);
+
+  if (gftp_cache_num_entries < 0)
+    gftp_cache_num_entries = gftp_trim_cache (cachedir, 0, cache_ttl);
+  else
+    gftp_cache_num_entries++;
 
-  if (centry->pos2 != NULL)
-    *centry->pos2 = '\t';
+  /* Trim a bit more than needed so that the directory isn't scanned
+     again on the next new entry */
+  if (cache_max_entries > 0 && gftp_cache_num_entries > cache_max_entries)
+    gftp_cache_num_entries = gftp_trim_cache (cachedir,
+                                              cache_max_entries * 9 / 10,
+                                              cache_ttl);
 
-  if (centry->pos3 != NULL)
-    *centry->pos3 = '\t';
+  g_mutex_unlock (&gftp_cache_mutex);
 }
 
 
@@ -120,17 +284,20 @@ gftp_generate_cache_description (gftp_request * request,
 int
 gftp_new_cache_entry (gftp_request * request)
 {
-  char *cachedir, *tempstr, *temp1str;
-  int cache_fd, fd;
+  char *cachedir, *tempstr, *temp1str, description[BUFSIZ];
   intptr_t cache_ttl;
   ssize_t ret;
+  int cache_fd;
   time_t t;
 
   gftp_lookup_request_option (request, "cache_ttl", &cache_ttl);
   time (&t);
   t += cache_ttl;
 
-  cachedir = g_strconcat (BASE_CONF_DIR, "/cache", NULL);
+  /* A listing that was never finished is thrown away */
+  gftp_finish_cache_entry (request, 0);
+
+  cachedir = gftp_get_cache_dir ();
   if (access (cachedir, F_OK) == -1)
     {
       if (mkdir (cachedir, S_IRUSR | S_IWUSR | S_IXUSR) < 0)
@@ -145,64 +312,85 @@ gftp_new_cache_entry (gftp_request * request)
         }
     }
 
-  tempstr = g_strdup_printf ("%s/index.db", cachedir);
-  if ((fd = gftp_fd_open (request, tempstr, O_WRONLY | O_APPEND | O_CREAT, 
-                          S_IRUSR | S_IWUSR)) == -1)
-    {
-      g_free (tempstr);
-      g_free (cachedir);
-      return (-1);
-    }
+  *description = '\0';
+  gftp_generate_cache_description (request, description, sizeof (description),
+                                   0);
 
-  g_free (tempstr);
+  temp1str = gftp_get_cache_file (cachedir, description);
+  tempstr = g_strconcat (temp1str, GFTP_CACHE_TMP_SUFFIX, NULL);
+  g_free (temp1str);
+  g_free (cachedir);
 
-  tempstr = g_strdup_printf ("%s/cache.XXXXXX", cachedir);
   if ((cache_fd = mkstemp (tempstr)) < 0)
     {
       g_free (tempstr);
-      g_free (cachedir);
       if (request != NULL)
         request->logging_function (gftp_logging_error, request,
                                  _("Error: Cannot create temporary file: %s\n"),
                                  g_strerror (errno));
       return (-1);
     }
-  g_free (cachedir);
 
-  lseek (fd, 0, SEEK_END);
-  temp1str = g_strdup_printf ("%s://%s@%s:%d%s\t%s\t%d\t%ld\n", 
-                           request->url_prefix,
-                           request->username == NULL ? "" : request->username,
-                           request->hostname == NULL ? "" : request->hostname,
-                           request->port, 
-                           request->directory == NULL ? "" : request->directory,
-                           tempstr, 0, t); // 0 = server_type
-  g_free (tempstr);
-  ret = gftp_fd_write (NULL, temp1str, strlen (temp1str), fd);
+  temp1str = g_strdup_printf ("%s\t%ld\n", description, t);
+  ret = gftp_fd_write (NULL, temp1str, strlen (temp1str), cache_fd);
   g_free (temp1str);
 
-  if (close (fd) != 0 || ret < 0)
+  if (ret < 0)
     {
       if (request != NULL)
         request->logging_function (gftp_logging_error, request,
-                                   _("Error closing file descriptor: %s\n"),
+                                   _("Error: Cannot write to cache: %s\n"),
                                    g_strerror (errno));
 
       close (cache_fd);
+      unlink (tempstr);
+      g_free (tempstr);
       return (-1);
     }
 
+  request->cachefile = tempstr;
   return (cache_fd);
 }
 
 
+/* Called once the listing that gftp_new_cache_entry() was opened for is
+   done. The entry replaces the previous listing of the directory when
+   commit is set, otherwise it is removed */
+void
+gftp_finish_cache_entry (gftp_request * request, int commit)
+{
+  char *cachefile, *cachedir;
+
+  g_return_if_fail (request != NULL);
+
+  if (request->cachefile == NULL)
+    return;
+
+  cachefile = g_strndup (request->cachefile, strlen (request->cachefile) -
+                                             strlen (GFTP_CACHE_TMP_SUFFIX));
+
+  if (commit && rename (request->cachefile, cachefile) == 0)
+    {
+      cachedir = gftp_get_cache_dir ();
+      gftp_count_new_cache_entry (request, cachedir);
+      g_free (cachedir);
+    }
+  else
+    unlink (request->cachefile);
+
+  g_free (cachefile);
+  g_free (request->cachefile);
+  request->cachefile = NULL;
+}
+
+
 int
 gftp_find_cache_entry (gftp_request * request)
 {
-  char *indexfile, buf[BUFSIZ], description[BUFSIZ];
-  gftp_getline_buffer * rbuf;
+  char *cachedir, *cachefile, buf[BUFSIZ], description[BUFSIZ];
   gftp_cache_entry centry;
-  int indexfd, cachefd;
+  struct stat st;
+  int cachefd;
   time_t now;
 
   time (&now);
@@ -211,89 +399,238 @@ gftp_find_cache_entry (gftp_request * request)
   gftp_generate_cache_description (request, description, sizeof (description),
                                    0);
 
-  indexfile = g_strconcat (BASE_CONF_DIR, "/cache/index.db", NULL);
-  if ((indexfd = gftp_fd_open (NULL, indexfile, O_RDONLY, 0)) == -1)
+  cachedir = gftp_get_cache_dir ();
+  cachefile = gftp_get_cache_file (cachedir, description);
+  g_free (cachedir);
+
+  if ((cachefd = gftp_fd_open (NULL, cachefile, O_RDONLY, 0)) == -1)
     {
-      g_free (indexfile);
+      g_free (cachefile);
       return (-1);
     }
-  g_free (indexfile);
 
-  rbuf = NULL;
-  while (gftp_get_line (NULL, &rbuf, buf, sizeof (buf), indexfd) > 0)
+  if (gftp_read_cache_header (request, &centry, buf, sizeof (buf), cachefd) < 0 ||
+      strcmp (description, centry.url) != 0)
     {
-      if (gftp_parse_cache_line (request, &centry, buf) < 0)
-        continue;
+      close (cachefd);
+      g_free (cachefile);
+      return (-1);
+    }
 
-      /* See if this entry is still valid... */
-      if (centry.expiration_date < now)
-        continue;
+  /* See if this entry is still valid... */
+  if (centry.expiration_date < now)
+    {
+      close (cachefd);
+      unlink (cachefile);
+      g_free (cachefile);
+      return (-1);
+    }
+
+  if (fstat (cachefd, &st) != 0 || st.st_size <= (off_t) centry.header_len)
+    { 
+      close (cachefd); 
+      g_free (cachefile);
+      return (-1);
+    } 
+
+  gftp_release_cache_entry (request);
+  request->cachemap = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                            cachefd, 0);
+  if (request->cachemap == MAP_FAILED)
+    {
+      request->logging_function (gftp_logging_error, request,
+                                 _("Error: Cannot map file %s: %s\n"),
+                                 cachefile, g_strerror (errno));
 
-      if (strcmp (description, centry.url) == 0)
-	{
-	  if (close (indexfd) != 0)
-            {
-              if (request != NULL)
-                request->logging_function (gftp_logging_error, request,
-                                       _("Error closing file descriptor: %s\n"),
-                                       g_strerror (errno));
-              return (-1);
-            }
-
-	  if ((cachefd = gftp_fd_open (request, centry.file, O_RDONLY, 0)) == -1)
-            return (-1);
-
-          if (lseek (cachefd, 0, SEEK_END) == 0)
-            { 
-              close (cachefd); 
-              return (-1);
-            } 
-
-          if (lseek (cachefd, 0, SEEK_SET) == -1)
-            {
-              if (request != NULL)
-                request->logging_function (gftp_logging_error, request,
-                                       _("Error: Cannot seek on file %s: %s\n"),
-                                       centry.file, g_strerror (errno));
-
-            }
-
-	  return (cachefd);
-	}
+      request->cachemap = NULL;
+      close (cachefd);
+      g_free (cachefile);
+      return (-1);
     }
-  close (indexfd);
-  return (-1);
+
+  request->cachemap_len = st.st_size;
+  request->cachemap_pos = centry.header_len;
+
+  /* Remember when the entry was used last */
+  futimens (cachefd, NULL);
+
+  g_free (cachefile);
+  return (cachefd);
 }
 
 
 void
-gftp_clear_cache_files (void)
+gftp_release_cache_entry (gftp_request * request)
 {
-  char *indexfile, buf[BUFSIZ];
-  gftp_getline_buffer * rbuf;
-  gftp_cache_entry centry;
-  int indexfd;
+  g_return_if_fail (request != NULL);
 
-  indexfile = g_strconcat (BASE_CONF_DIR, "/cache/index.db", NULL);
-  if ((indexfd = gftp_fd_open (NULL, indexfile, O_RDONLY, 0)) == -1)
+  if (request->cachemap == NULL)
+    return;
+
+  munmap (request->cachemap, request->cachemap_len);
+  request->cachemap = NULL;
+  request->cachemap_len = 0;
+  request->cachemap_pos = 0;
+}
+
+
+int
+gftp_write_cache_file (gftp_request * request, gftp_file * fle)
+{
+  gftp_cache_record record;
+  struct iovec iov[4];
+  ssize_t ret;
+  size_t len;
+
+  g_return_val_if_fail (request != NULL, GFTP_EFATAL);
+  g_return_val_if_fail (fle != NULL, GFTP_EFATAL);
+  g_return_val_if_fail (fle->file != NULL, GFTP_EFATAL);
+
+  memset (&record, 0, sizeof (record));
+  record.datetime = fle->datetime;
+  record.size = fle->size;
+  record.st_mode = fle->st_mode;
+  record.flags = fle->filename_utf8_encoded ? GFTP_CACHE_FILE_UTF8 : 0;
+  record.file_len = strlen (fle->file) + 1;
+  record.user_len = fle->user == NULL ? 0 : strlen (fle->user) + 1;
+  record.group_len = fle->group == NULL ? 0 : strlen (fle->group) + 1;
+
+  iov[0].iov_base = &record;
+  iov[0].iov_len = sizeof (record);
+  iov[1].iov_base = fle->file;
+  iov[1].iov_len = record.file_len;
+  iov[2].iov_base = fle->user;
+  iov[2].iov_len = record.user_len;
+  iov[3].iov_base = fle->group;
+  iov[3].iov_len = record.group_len;
+  len = sizeof (record) + record.file_len + record.user_len + record.group_len;
+
+  do
+    ret = writev (request->cachefd, iov, 4);
+  while (ret < 0 && errno == EINTR);
+
+  if (ret < 0 || (size_t) ret != len)
     {
-      g_free (indexfile);
-      return;
+      if (ret >= 0)
+        errno = ENOSPC;
+
+      request->logging_function (gftp_logging_error, request,
+                                 _("Error: Cannot write to cache: %s\n"),
+                                 g_strerror (errno));
+      return (GFTP_ERETRYABLE);
     }
 
-  *buf = '\0';
-  rbuf = NULL;
-  while (gftp_get_line (NULL, &rbuf, buf, sizeof (buf), indexfd) > 0)
+  return (ret);
+}
+
+
+static char *
+gftp_cache_record_string (const char *pos, guint32 len)
+{
+  if (len == 0)
+    return (NULL);
+  else if (pos[len - 1] != '\0')
+    return (NULL);
+
+  return (g_strndup (pos, len - 1));
+}
+
+
+/* Returns the next file of the cache entry mapped by
+   gftp_find_cache_entry(), in the same way as the get_next_file function
+   of the protocols */
+int
+gftp_read_cache_file (gftp_request * request, gftp_file * fle)
+{
+  gftp_cache_record record;
+  const char *pos;
+  size_t left, len;
+
+  g_return_val_if_fail (request != NULL, GFTP_EFATAL);
+  g_return_val_if_fail (request->cachemap != NULL, GFTP_EFATAL);
+
+  left = request->cachemap_len - request->cachemap_pos;
+  if (left == 0)
+    return (0);
+
+  pos = request->cachemap + request->cachemap_pos;
+  if (left < sizeof (record))
+    len = 0;
+  else
     {
-      if (gftp_parse_cache_line (NULL, &centry, buf) < 0)
-        continue;
+      memcpy (&record, pos, sizeof (record));
+      len = sizeof (record) + (size_t) record.file_len + record.user_len +
+            record.group_len;
+    }
 
-      unlink (centry.file);
+  if (len == 0 || len > left || record.file_len == 0)
+    {
+      request->logging_function (gftp_logging_error, request,
+                                 _("Error: The cache entry for %s is damaged\n"),
+                                 request->directory);
+      return (GFTP_EFATAL);
     }
 
-  close (indexfd);
-  unlink (indexfile);
-  g_free (indexfile);
+  pos += sizeof (record);
+  fle->file = gftp_cache_record_string (pos, record.file_len);
+  pos += record.file_len;
+  fle->user = gftp_cache_record_string (pos, record.user_len);
+  pos += record.user_len;
+  fle->group = gftp_cache_record_string (pos, record.group_len);
+
+  fle->datetime = record.datetime;
+  fle->size = record.size;
+  fle->st_mode = record.st_mode;
+  fle->filename_utf8_encoded = (record.flags & GFTP_CACHE_FILE_UTF8) != 0;
+
+  request->cachemap_pos += len;
+
+  if (fle->file == NULL)
+    {
+      request->logging_function (gftp_logging_error, request,
+                                 _("Error: The cache entry for %s is damaged\n"),
+                                 request->directory);
+      return (GFTP_EFATAL);
+    }
+
+  return (len);
+}
+
+
+void
+gftp_clear_cache_files (void)
+{
+  struct dirent * dirent;
+  char *cachedir, *file;
+  DIR * dir;
+
+  cachedir = gftp_get_cache_dir ();
+
+  g_mutex_lock (&gftp_cache_mutex);
+
+  /* This also removes the index.db of older versions and the listings
+     that were not finished */
+  if ((dir = opendir (cachedir)) != NULL)
+    {
+      while ((dirent = readdir (dir)) != NULL)
+        {
+          if (strcmp (dirent->d_name, ".") == 0 ||
+              strcmp (dirent->d_name, "..") == 0)
+            continue;
+
+          file = g_strdup_printf ("%s/%s", cachedir, dirent->d_name);
+          unlink (file);
+          g_free (file);
+        }
+
+      closedir (dir);
+    }
+
+  gftp_cache_num_entries = 0;
+
+  g_mutex_unlock (&gftp_cache_mutex);
+
+  g_free (cachedir);
 }
 
 
@@ -301,16 +638,15 @@ void
 gftp_delete_cache_entry (gftp_request * request, char *descr, 
                          int ignore_directory)
 {
-  char *oldindexfile, *newindexfile, buf[BUFSIZ], description[BUFSIZ];
-  int indexfd, newfd, del_entry;
-  gftp_getline_buffer * rbuf;
+  char *cachedir, *cachefile, buf[BUFSIZ], description[BUFSIZ];
   gftp_cache_entry centry;
+  GList * files, * templist;
+  gftp_cache_lru * lru;
   size_t len;
-  time_t now;
+  int fd;
  
   g_return_if_fail (request != NULL || descr != NULL);
 
-  time (&now);
   if (request != NULL)
     {
       *description = '\0';
@@ -325,70 +661,51 @@ gftp_delete_cache_entry (gftp_request * request, char *descr,
   else
     return;
 
-  oldindexfile = g_strconcat (BASE_CONF_DIR, "/cache/index.db", NULL);
-  if ((indexfd = gftp_fd_open (NULL, oldindexfile, O_RDONLY, 0)) == -1)
-    {
-      g_free (oldindexfile);
-      return;
-    }
+  cachedir = gftp_get_cache_dir ();
 
-  newindexfile = g_strconcat (BASE_CONF_DIR, "/cache/index.db.new", NULL);
-  if ((newfd = gftp_fd_open (request, newindexfile, O_WRONLY | O_CREAT, 
-                             S_IRUSR | S_IWUSR)) == -1)
+  if (!ignore_directory)
     {
-      g_free (oldindexfile);
-      g_free (newindexfile);
+      cachefile = gftp_get_cache_file (cachedir, description);
+      if (unlink (cachefile) == 0)
+        {
+          g_mutex_lock (&gftp_cache_mutex);
+          if (gftp_cache_num_entries > 0)
+            gftp_cache_num_entries--;
+          g_mutex_unlock (&gftp_cache_mutex);
+        }
+
+      g_free (cachefile);
+      g_free (cachedir);
       return;
     }
 
-  *buf = '\0';
-  rbuf = NULL;
-  while (gftp_get_line (NULL, &rbuf, buf, sizeof (buf) - 1, indexfd) > 0)
+  /* Every directory of the site has to go, so this is the one case where
+     all of the entries are looked at */
+  g_mutex_lock (&gftp_cache_mutex);
+
+  len = strlen (description);
+  files = gftp_list_cache_files (cachedir);
+  for (templist = files; templist != NULL; templist = templist->next)
     {
-      if (gftp_parse_cache_line (request, &centry, buf) < 0)
-        continue;
+      lru = templist->data;
 
-      del_entry = 0;
-      if (centry.expiration_date < now)
-        del_entry = 1;
-      else if (ignore_directory)
-        {
-          if (strncmp (centry.url, description, strlen (description)) == 0)
-            del_entry = 1;
-        }
-      else
+      if ((fd = gftp_fd_open (NULL, lru->file, O_RDONLY, 0)) != -1)
         {
-          if (strcmp (centry.url, description) == 0)
-            del_entry = 1;
-        }
+          if (gftp_read_cache_header (NULL, &centry, buf, sizeof (buf), fd) == 0 &&
+              strncmp (centry.url, description, len) == 0 &&
+              unlink (lru->file) == 0 && gftp_cache_num_entries > 0)
+            gftp_cache_num_entries--;
 
- 
-      if (del_entry)
-        unlink (centry.file);
-      else
-        {
-          /* Make sure we put the tabs back in the line. I do it this way 
-             so that I don't have to allocate memory again for each line 
-             as we read it */
-          gftp_restore_cache_line (&centry);
-
-          /* Make sure when we call gftp_get_line() that we pass the read size
-             as sizeof(buf) - 1 so that we'll have room to put the newline */
-          len = strlen (buf);
-          buf[len--] = '\n';
-
-          if (gftp_fd_write (NULL, buf, len, newfd) < 0)
-            break;
+          close (fd);
         }
+
+      g_free (lru->file);
+      g_free (lru);
     }
 
-  close (indexfd);
-  close (newfd);
+  g_list_free (files);
 
-  unlink (oldindexfile);
-  rename (newindexfile, oldindexfile);
+  g_mutex_unlock (&gftp_cache_mutex);
 
-  g_free (oldindexfile);
-  g_free (newindexfile);
+  g_free (cachedir);
 }
-
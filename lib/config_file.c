@@ -578,6 +578,19 @@ gftp_read_config_file (char *global_data_path)
               exit (EXIT_FAILURE);
             }
         }
+      else if (strcmp (buf, "one_transfer") == 0)
+        {
+          /* Replaced by max_transfers, one_transfer=1 is max_transfers=1 */
+          if (strtol (curpos + 1, NULL, 10) != 0 &&
+              (tmpconfigvar = g_hash_table_lookup (gftp_global_options_htable,
+                                                   "max_transfers")) != NULL)
+            {
+              gftp_option_types[tmpconfigvar->otype].read_function ("1",
+                                tmpconfigvar, line);
+              printf (_("gFTP Warning: one_transfer at line %d in config file is now max_transfers=1\n"),
+                      line);
+            }
+        }
       else
         {
           printf (_("gFTP Warning: Skipping line %d in config file: %s\n"),
@@ -1166,6 +1179,11 @@ gftp_option_type_var gftp_option_types[] = {
 };
 
 
+/* Bumped whenever an option is changed, so that the copies in
+   gftp_request_options can tell that they are stale */
+static volatile gint gftp_options_serial = 1;
+
+
 void
 gftp_lookup_global_option (const char * key, void *value)
 {
@@ -1202,6 +1220,32 @@ gftp_lookup_request_option (gftp_request * request, const char * key,
 }
 
 
+const gftp_request_options *
+gftp_get_request_options (gftp_request * request)
+{
+  /* Needed for systems that size(float) < size(void *) */
+  union { intptr_t i; float f; } maxkbs;
+  gftp_request_options * options;
+  gint serial;
+
+  options = &request->options;
+  serial = g_atomic_int_get (&gftp_options_serial);
+  if (g_atomic_int_get (&options->serial) != serial)
+    {
+      gftp_lookup_request_option (request, "network_timeout",
+                                  &options->network_timeout);
+      gftp_lookup_request_option (request, "show_hidden_files",
+                                  &options->show_hidden_files);
+      gftp_lookup_request_option (request, "maxkbs", &maxkbs.f);
+      options->maxkbs = maxkbs.f;
+
+      g_atomic_int_set (&options->serial, serial);
+    }
+
+  return (options);
+}
+
+
 void
 gftp_lookup_bookmark_option (gftp_bookmarks_var * bm, const char * key,
                              void *value)
@@ -1240,6 +1284,7 @@ gftp_set_global_option (const char * key, const void *value)
         {
           gftp_option_types[tmpconfigvar->otype].copy_function (&newconfigvar, tmpconfigvar);
           gftp_configuration_changed = 1;
+          g_atomic_int_inc (&gftp_options_serial);
         }
     }
   else
@@ -1272,6 +1317,7 @@ gftp_set_request_option (gftp_request * request, const char * key,
                          const void *value)
 {
   gftp_config_vars * tmpconfigvar;
+  int i;
 
   if (request->local_options_hash == NULL)
     request->local_options_hash = g_hash_table_new (string_hash_function,
@@ -1297,8 +1343,12 @@ gftp_set_request_option (gftp_request * request, const char * key,
       memcpy (&request->local_options_vars[request->num_local_options_vars - 1], tmpconfigvar, sizeof (*tmpconfigvar));
       _gftp_set_option_value (&request->local_options_vars[request->num_local_options_vars - 1], value);
 
-      g_hash_table_insert (request->local_options_hash, request->local_options_vars[request->num_local_options_vars - 1].key, &request->local_options_vars[request->num_local_options_vars - 1]);
+      /* The array may have moved, point all of the hash entries at it again */
+      for (i = 0; i < request->num_local_options_vars; i++)
+        g_hash_table_insert (request->local_options_hash, request->local_options_vars[i].key, &request->local_options_vars[i]);
     }
+
+  g_atomic_int_inc (&gftp_options_serial);
 }
 
 
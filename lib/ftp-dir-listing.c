@@ -188,6 +188,17 @@ static char * copy_token (char **dest, char *source)
 }
 
 
+static size_t token_len (const char *pos)
+{
+  size_t len = 0;
+
+  while (pos[len] != ' ' && pos[len] != '\t' && pos[len] != '\0') {
+    len++;
+  }
+  return (len);
+}
+
+
 static char * goto_next_token (char *pos)
 {
   while (*pos != ' ' && *pos != '\t' && *pos != '\0') {
@@ -515,7 +526,7 @@ static int ftp_parse_ls_unix (gftp_request * request, char *str, size_t slen,
                                gftp_file * fle)
 {
   //DEBUG_TRACE("LSUNIX: %s\n", str);
-  char *endpos, *startpos, *pos, *attribs;
+  char *endpos, *startpos, *pos;
   int cols;
   ftp_protocol_data * ftpdat = request->protocol_data;
 
@@ -547,16 +558,12 @@ static int ftp_parse_ls_unix (gftp_request * request, char *str, size_t slen,
         pos++;
     }
 
-  startpos = str;
-  /* Copy file attributes */
-  if ((startpos = copy_token (&attribs, startpos)) == NULL)
-    return (GFTP_EFATAL);
-
-  if (strlen (attribs) < 10)
+  /* File attributes, they are read where they are */
+  if (token_len (str) < 10 || str[token_len (str)] == '\0')
     return (GFTP_EFATAL);
 
-  fle->st_mode = gftp_convert_attributes_to_mode_t (attribs);
-  g_free (attribs);
+  fle->st_mode = gftp_convert_attributes_to_mode_t (str);
+  startpos = goto_next_token (str);
 
   if (cols >= 9)
     {
@@ -720,12 +727,10 @@ static int ftp_parse_ls_mlsd (char *str, gftp_file * fle)
    // modify=20210930020540;perm=flcdmpe;type=dir;unique=36U22;UNIX.group=65534;UNIX.mode=0755;UNIX.owner=112; mrtg
    // modify=20180626065826;perm=adfr;size=400;type=file;unique=2DU104;UNIX.group=0;UNIX.mode=0644;UNIX.owner=0; HEADER.html
    //DEBUG_TRACE("MLSD: %s\n", str)
-   int ntokens, i;
-   char ** tokens;
    char * filename, * strtype, * strsize, * strmodify, * strperm;
    char * strunix_uid, * strunix_gid, * strunix_mode;
    char * strunix_owner, * strunix_group, * strunix_ownername, * strunix_groupname;
-   char * p;
+   char * p, * next;
    struct tm stm;
    unsigned fmode = 0;
 
@@ -756,92 +761,66 @@ static int ftp_parse_ls_mlsd (char *str, gftp_file * fle)
       return GFTP_EFATAL;
    }
 
-   // determine number of tokens
-   p = str;
-   ntokens = 0;
-   while (*p) {
-      if (*p == ';') ntokens++;
-      p++;
-   }
-   //DEBUG_TRACE("tokens: %d\n", ntokens)
-   tokens = (char**) calloc (ntokens+1, sizeof(char**));
-
-   // tokenize; assign tokens
-   p = str;
-   tokens[0] = str; // first token is already determined...
-   i = 1;
-   while (*p)
+   // walk the facts in place: fact=value;fact=value;
+   for (p = str; p != NULL && *p; p = next)
    {
-      if (*p == ';') {
-         *p = 0;
-         p++;
-         if (!*p) {
-            break;
-         }
-         tokens[i] = p;
-         i++;
-         continue;
+      next = strchr (p, ';');
+      if (next) {
+         *next = 0;
+         next++;
       }
-      p++;
-   }
-   tokens[ntokens] = NULL;
-
-   // assign str* variables
-   for (i = 0; tokens[i]; i++)
-   {
-      //DEBUG_PUTS(tokens[i])
-      if (strncasecmp (tokens[i], "type=", 5) == 0) {
-         strtype = tokens[i] + 5;
+      //DEBUG_PUTS(p)
+      if (strncasecmp (p, "type=", 5) == 0) {
+         strtype = p + 5;
          continue;
       }
-      if (strncasecmp (tokens[i], "size=", 5) == 0) {
-         strsize = tokens[i] + 5;
+      if (strncasecmp (p, "size=", 5) == 0) {
+         strsize = p + 5;
          continue;
       }
-      if (strncasecmp (tokens[i], "perm=", 5) == 0) {
-         strperm = tokens[i] + 5;
+      if (strncasecmp (p, "perm=", 5) == 0) {
+         strperm = p + 5;
          continue;
       }
-      if (strncasecmp (tokens[i], "modify=", 7) == 0) {
-         strmodify = tokens[i] + 7;
+      if (strncasecmp (p, "modify=", 7) == 0) {
+         strmodify = p + 7;
          continue;
       }
-      if (strncasecmp (tokens[i], "unix.mode=", 10) == 0) {
-         strunix_mode = tokens[i] + 10;
+      if (strncasecmp (p, "unix.mode=", 10) == 0) {
+         strunix_mode = p + 10;
          continue;
       }
-      if (strncasecmp (tokens[i], "unix.uid=", 9) == 0) {
-         strunix_uid = tokens[i] + 9;
+      if (strncasecmp (p, "unix.uid=", 9) == 0) {
+         strunix_uid = p + 9;
          if (!*strunix_uid) strunix_uid = NULL;
          continue;
       }
-      if (strncasecmp (tokens[i], "unix.gid=", 9) == 0) {
-         strunix_gid = tokens[i] + 9;
+      if (strncasecmp (p, "unix.gid=", 9) == 0) {
+         strunix_gid = p + 9;
          if (!*strunix_gid) strunix_gid = NULL;
          continue;
       }
-      if (strncasecmp (tokens[i], "unix.owner=", 11) == 0) {
-         strunix_owner = tokens[i] + 11;
+      if (strncasecmp (p, "unix.owner=", 11) == 0) {
+         strunix_owner = p + 11;
          if (!*strunix_owner) strunix_owner = NULL;
          continue;
       }
-      if (strncasecmp (tokens[i], "unix.group=", 11) == 0) {
-         strunix_group = tokens[i] + 11;
+      if (strncasecmp (p, "unix.group=", 11) == 0) {
+         strunix_group = p + 11;
          if (!*strunix_group) strunix_group = NULL;
          continue;
       }
-      if (strncasecmp (tokens[i], "unix.ownername=", 15) == 0) {
-         strunix_ownername = tokens[i] + 15;
+      if (strncasecmp (p, "unix.ownername=", 15) == 0) {
+         strunix_ownername = p + 15;
          if (!*strunix_ownername) strunix_ownername = NULL;
          continue;
       }
-      if (strncasecmp (tokens[i], "unix.groupname=", 15) == 0) {
-         strunix_groupname = tokens[i] + 15;
+      if (strncasecmp (p, "unix.groupname=", 15) == 0) {
+         strunix_groupname = p + 15;
          if (!*strunix_groupname) strunix_groupname = NULL;
          continue;
       }
    }
-   free (tokens);
 
    if (!filename || !*filename || !strtype || !*strtype) {
       return GFTP_EFATAL;
@@ -909,7 +888,7 @@ int ftp_parse_ls (gftp_request * request, const char *lsoutput, gftp_file * fle,
                int fd)
 {
   DEBUG_TRACE("LS(%ld): %s\n", strlen(lsoutput), lsoutput)
-  char *str;
+  char buf[2048], *str;
   int result;
   size_t len;
   ftp_protocol_data * ftpdat;
@@ -919,10 +898,19 @@ int ftp_parse_ls (gftp_request * request, const char *lsoutput, gftp_file * fle,
   g_return_val_if_fail (fle != NULL, GFTP_EFATAL);
 
   ftpdat = request->protocol_data;
-  str = g_strdup (lsoutput);
   memset (fle, 0, sizeof (*fle));
 
-  len = strlen (str);
+  /* The parsers cut the line up, work on a copy. Lines from the data
+     connection always fit in buf */
+  len = strlen (lsoutput);
+  if (len < sizeof (buf))
+    {
+      memcpy (buf, lsoutput, len + 1);
+      str = buf;
+    }
+  else
+    str = g_strdup (lsoutput);
+
   if (len > 0 && str[len - 1] == '\n')
     str[--len] = '\0';
   if (len > 0 && str[len - 1] == '\r')
@@ -980,7 +968,8 @@ int ftp_parse_ls (gftp_request * request, const char *lsoutput, gftp_file * fle,
         result = -1;
         break;
   }
-  g_free (str);
+  if (str != buf)
+    g_free (str);
 
   return (result);
 }
@@ -48,10 +48,17 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <poll.h>
+#ifdef HAVE_SENDFILE_SPLICE
+#include <sys/sendfile.h>
+#endif
 #ifndef TIOCGWINSZ
 #include <sys/ioctl.h>
 #endif
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <sys/utsname.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -172,6 +179,8 @@
 #define GFTP_ENOTRANS   -4 /* Custom error. This is returned when a FXP transfer is requested */
 #define GFTP_ETIMEDOUT  -5 /* Connected timed out */
 #define GFTP_ECANIGNORE -6 /* Error that can be ignored */
+#define GFTP_ENORANGE   -7 /* The server sent the whole file instead of the
+                              range that was asked for */
 
 /* Some general settings */
 extern char * BASE_CONF_DIR; // see misc.c: gftp_locale_init()
@@ -205,6 +214,13 @@ typedef struct gftp_file_tag gftp_file;
 
 #define GFTP_IS_SPECIAL_DEVICE(mode) (S_ISBLK (mode) || S_ISCHR (mode))
 
+typedef struct gftp_file_segment_tag
+{
+  off_t start;  /* Offset of the first byte of this range */
+  off_t end;    /* Offset just past the last byte of this range */
+  off_t done;   /* Number of bytes of this range that are on disk */
+} gftp_file_segment;
+
 struct gftp_file_tag 
 {
   char *file;      /* @null@ Our filename */
@@ -230,6 +246,7 @@ struct gftp_file_tag
   unsigned int done_rm : 1;   /* Remove the file when done */
   unsigned int transfer_done : 1;  /* Is current file transfer done? */
   unsigned int retry_transfer : 1; /* Is current file transfer done? */
+  unsigned int transfer_queued : 1; /* Has a transfer worker taken this file? */
   unsigned int exists_other_side : 1; /* The file exists on the other side
                                          during the file transfer */
   unsigned int filename_utf8_encoded : 1; /* Is the filename properly UTF8encoded? */
@@ -237,6 +254,9 @@ struct gftp_file_tag
   char transfer_action; /* See the GFTP_TRANS_ACTION_* vars above */
   void *user_data;      /* @null@ */
   unsigned int free_user_data;
+
+  gftp_file_segment * segments; /* @null@ Ranges of a segmented download */
+  unsigned int num_segments;
 };
 
 
@@ -331,6 +351,17 @@ typedef void (*gftp_logging_func) (gftp_logging_level level,
                                       && ((request)->password == NULL || *(request)->password == '\0'))
 
 
+/* Copies of the options that are read for every block or listing line,
+   see gftp_get_request_options () */
+typedef struct gftp_request_options_tag
+{
+  gint serial;  /* Value of the options serial when these were looked up */
+  intptr_t network_timeout;
+  intptr_t show_hidden_files;
+  float maxkbs;
+} gftp_request_options;
+
+
 struct gftp_request_tag 
 {
   int protonum;     /* Current number of the protocol this is  set to */
@@ -341,13 +372,20 @@ struct gftp_request_tag
   char *directory;  /* Current working directory */
   char *url_prefix; /* URL Prefix (ex: ftp) */
   char *last_ftp_response;   /* Last response from server */
-  char *last_dir_entry;      /* Last dir entry from server */
-  size_t last_dir_entry_len; /* Length of last_dir_entry */
 
   unsigned int port; /* Port of remote site */
 
   int datafd;   /* Data connection */
   int cachefd;  /* For the directory cache */
+  char *cachefile; /* Cache entry that is being written */
+  char *cachemap;  /* Cache entry that is being read */
+  size_t cachemap_len;
+  size_t cachemap_pos;
+
+#ifdef USE_SSL
+  SSL * ssl;      /* TLS session on datafd */
+  SSL * data_ssl; /* TLS session on the FTPS data connection */
+#endif
 
   GIOChannel * chan;
   int wakeup_main_thread[2]; /* FD that gets written to by the threads to wakeup the parent */
@@ -371,6 +409,7 @@ struct gftp_request_tag
   unsigned int use_local_encoding : 1;
 
   off_t gotbytes;
+  off_t range_end; /* If set, get_file only needs the bytes before this offset */
  
   void *protocol_data;
    
@@ -409,6 +448,7 @@ struct gftp_request_tag
 
   ssize_t (*get_next_file_chunk) (gftp_request * request, char *buf, size_t size);
   ssize_t (*put_next_file_chunk) (gftp_request * request, char *buf, size_t size);
+  int (*get_raw_data_fd) (gftp_request * request);
 
   int (*end_transfer)   (gftp_request * request);
   int (*abort_transfer) (gftp_request * request);
@@ -437,6 +477,7 @@ struct gftp_request_tag
   gftp_config_vars * local_options_vars;
   int num_local_options_vars;
   GHashTable * local_options_hash;
+  gftp_request_options options;
 
   GIConv iconv_to; 
   GIConv iconv_from; 
@@ -462,11 +503,12 @@ typedef struct gftp_transfer_tag
   unsigned int next_file : 1;
   unsigned int skip_file : 1;
 
-  struct timeval starttime;
-  struct timeval lasttime;
+  gint64 starttime; /* g_get_monotonic_time () */
+  gint64 lasttime;
 
   double kbs;
-  
+  size_t blksize; /* Block size of the current file, when it is adaptive */
+
   GList * files;
   GList * curfle;
   GList * updfle;
@@ -482,11 +524,19 @@ typedef struct gftp_transfer_tag
   off_t trans_bytes;   /* Amount of data transferred for entire  transfer */
   off_t total_bytes;   /* Grand total bytes for whole transfer */
   off_t resumed_bytes; /* Grand total of resumed bytes for whole  transfer */
+  off_t zero_copy_bytes; /* Bytes moved by the kernel, see gftp_zero_copy_file_chunk() */
+  double zero_copy_cpu;  /* CPU seconds used while moving them */
+
+  gftp_request ** segment_reqs; /* Connections of the segments of a file, kept
+                                   for the next file that is split up */
+  int num_segment_reqs;
 
   void * fromwdata;
   void * towdata;
 
-  GMutex statmutex;
+  gint stat_seq; /* Odd while the statistics are being updated */
+  gint shown_seq; /* stat_seq when the UI last showed the statistics */
+  int shown_stalled;
   GMutex structmutex;
 
   void *user_data;
@@ -495,10 +545,36 @@ typedef struct gftp_transfer_tag
 } gftp_transfer;
 
 
+/* A consistent copy of the statistics of a transfer, see
+   gftp_get_transfer_stats() */
+typedef struct gftp_transfer_stats_tag
+{
+  off_t curtrans;
+  off_t tot_file_trans;
+  off_t curresumed;
+  off_t trans_bytes;
+  off_t total_bytes;
+  off_t resumed_bytes;
+  double kbs;
+  size_t blksize;
+  gint64 lasttime;
+} gftp_transfer_stats;
+
+
+/* See gftp_get_buffer_pool_stats() */
+typedef struct gftp_buffer_pool_stats_tag
+{
+  guint allocated; /* Buffers that had to be allocated */
+  guint reused;    /* Buffers that were taken from a pool */
+  guint released;  /* Buffers that were given back to the system */
+} gftp_buffer_pool_stats;
+
+
 typedef struct gftp_log_tag
 {
   char *msg;
   gftp_logging_level type;
+  struct gftp_log_tag * next;
 } gftp_log;
 
 
@@ -571,7 +647,7 @@ typedef struct gftp_getline_buffer_tag
 
 /* Global config options. These are defined in options.h */
 extern GList * gftp_file_transfers;     /*@null@*/
-extern GList * gftp_file_transfer_logs; /*@null@*/
+extern gftp_log * gftp_file_transfer_logs; /*@null@*/
 extern GList * gftp_options_list;       /*@null@*/
 extern GHashTable * gftp_global_options_htable; /*@null@*/
 extern GHashTable * gftp_bookmarks_htable;      /*@null@*/
@@ -586,6 +662,11 @@ extern int gftp_configuration_changed;
 extern gftp_option_type_var gftp_option_types[];
 
 
+/* bufpool.c */
+char * gftp_buffer_get (size_t size);
+void gftp_buffer_put (char *buf, size_t size);
+void gftp_get_buffer_pool_stats (gftp_buffer_pool_stats * stats);
+
 /* cache.c */
 void gftp_generate_cache_description (gftp_request * request, 
                                       /*@out@*/ char *description,
@@ -594,6 +675,13 @@ void gftp_generate_cache_description (gftp_request * request,
 
 int gftp_new_cache_entry    (gftp_request * request);
 int gftp_find_cache_entry   (gftp_request * request);
+void gftp_finish_cache_entry (gftp_request * request,
+                              int commit);
+void gftp_release_cache_entry (gftp_request * request);
+int gftp_write_cache_file   (gftp_request * request,
+                             gftp_file * fle);
+int gftp_read_cache_file    (gftp_request * request,
+                             gftp_file * fle);
 void gftp_clear_cache_files (void);
 
 void gftp_delete_cache_entry  (gftp_request * request,
@@ -628,6 +716,8 @@ void gftp_lookup_bookmark_option (gftp_bookmarks_var * bm,
                                   const char * key,
                                   void *value);
 
+const gftp_request_options * gftp_get_request_options (gftp_request * request);
+
 void gftp_set_global_option (const char * key, const void *value);
 
 void gftp_set_request_option (gftp_request * request, 
@@ -720,6 +810,8 @@ int ftp_init (gftp_request * request);
 void ftp_register_module (void);
 int ftp_get_next_file (gftp_request * request, gftp_file *fle, int fd);
 int ftp_connect       (gftp_request * request);
+unsigned int ftp_is_ascii_transfer (gftp_request * request,
+                                    const char *filename);
 
 /* protocol_ftps.c */
 int ftps_init (gftp_request * request);
@@ -730,6 +822,8 @@ void ftpsi_register_module (void);
 /* protocol_localfs.c */
 int localfs_init (gftp_request * request);
 void localfs_register_module (void);
+int localfs_open_segmented_file (gftp_request * request, const char *filename,
+                                 off_t truncate_size);
 
 /* protocol_http.c */
 int http_init              (gftp_request * request);
@@ -774,6 +868,10 @@ off_t gftp_transfer_file (gftp_request *fromreq,
 
 ssize_t gftp_get_next_file_chunk (gftp_request * request, char *buf, size_t size);
 ssize_t gftp_put_next_file_chunk (gftp_request * request, char *buf, size_t size);
+int gftp_can_zero_copy (gftp_request * fromreq, gftp_request * toreq);
+ssize_t gftp_zero_copy_file_chunk (gftp_request * fromreq,
+                                   gftp_request * toreq, int *pipefd,
+                                   size_t size);
 
 int gftp_list_files (gftp_request * request);
 
@@ -827,6 +925,10 @@ int gftp_set_config_options (gftp_request * request);
 void print_file_list (GList * list);
 void gftp_swap_socks (gftp_request * dest, gftp_request * source);
 void gftp_calc_kbs   (gftp_transfer * tdata, ssize_t num_read);
+void gftp_transfer_stats_begin (gftp_transfer * tdata);
+void gftp_transfer_stats_end (gftp_transfer * tdata);
+void gftp_get_transfer_stats (gftp_transfer * tdata,
+                              gftp_transfer_stats * stats);
 int gftp_get_transfer_status (gftp_transfer * tdata, ssize_t num_read);
 
 int gftp_fd_open (gftp_request * request, 
@@ -854,6 +956,7 @@ ssize_t gftp_ssl_read  (gftp_request * request, void       *ptr, size_t size, in
 ssize_t gftp_ssl_write (gftp_request * request, const char *ptr, size_t size, int fd);
 void gftp_ssl_session_close_ex (gftp_request * request, int fd);
 void gftp_ssl_session_close (gftp_request * request);
+void gftp_ssl_set_owner (gftp_request * request);
 #endif /* USE_SSL */
 
 /* UI dependent functions that must be implemented */
@@ -892,10 +995,21 @@ ssize_t gftp_get_line (gftp_request * request,
                        size_t len, 
                        int fd);
 
+gftp_getline_buffer * gftp_new_getline_buffer (size_t bufsize);
+
 void gftp_free_getline_buffer (gftp_getline_buffer ** rbuf);
 
+int gftp_fd_wait (gftp_request * request, int fd, short events);
+int gftp_fd_get_send_queue (int fd, int *sndbuf, int *queued);
 ssize_t gftp_fd_read  (gftp_request * request, void *ptr, size_t size, int fd);
 ssize_t gftp_fd_write (gftp_request * request, const char *ptr, size_t size, int fd);
+ssize_t gftp_fd_writev (gftp_request * request, struct iovec *iov, int iovcnt, int fd);
+#ifdef HAVE_SENDFILE_SPLICE
+ssize_t gftp_fd_sendfile (gftp_request * request, int infd, int outfd,
+                          size_t size);
+ssize_t gftp_fd_splice (gftp_request * request, int infd, int outfd,
+                        int *pipefd, size_t size);
+#endif
 ssize_t gftp_writefmt (gftp_request * request, int fd, const char *fmt, ...);
 
 int gftp_fd_get_sockblocking (gftp_request * request, int fd);
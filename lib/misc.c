@@ -229,13 +229,11 @@ int gftp_match_filespec (gftp_request * request, const char *filename,
                          const char *filespec)
 {
    //DEBUG_PRINT_FUNC
-   intptr_t show_hidden_files;
-  
    if (!filename || !*filename || !filespec || !*filespec) {
       return (1);
    }
-   gftp_lookup_request_option (request, "show_hidden_files", &show_hidden_files);
-   if (!show_hidden_files && *filename == '.' && strcmp (filename, "..") != 0) {
+   if (!gftp_get_request_options (request)->show_hidden_files &&
+       *filename == '.' && strcmp (filename, "..") != 0) {
       return (0);
    }
    if (fnmatch (filespec, filename, 0) == 0) {
@@ -420,6 +418,8 @@ gftp_file * copy_fdata (gftp_file * fle)
     newfle->destfile = g_strdup (fle->destfile);
 
   newfle->user_data = NULL;
+  newfle->segments = NULL;
+  newfle->num_segments = 0;
   return (newfle);
 }
 
@@ -477,7 +477,6 @@ gftp_transfer * gftp_tdata_new (void)
 
   tdata = g_malloc0 (sizeof (*tdata));
 
-  g_mutex_init (&tdata->statmutex);
   g_mutex_init (&tdata->structmutex);
 
   return (tdata);
@@ -487,8 +486,13 @@ gftp_transfer * gftp_tdata_new (void)
 void free_tdata (gftp_transfer * tdata)
 {
   DEBUG_PRINT_FUNC
+  int i;
+
   if (tdata->fromreq)   gftp_request_destroy (tdata->fromreq, 1);
   if (tdata->toreq)     gftp_request_destroy (tdata->toreq, 1);
+  for (i = 0; i < tdata->num_segment_reqs; i++)
+    if (tdata->segment_reqs[i]) gftp_request_destroy (tdata->segment_reqs[i], 1);
+  if (tdata->segment_reqs) g_free (tdata->segment_reqs);
   if (tdata->thread_id) g_free (tdata->thread_id);
   free_file_list (tdata->files);
   g_free (tdata);
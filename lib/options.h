@@ -67,6 +67,19 @@ gftp_config_vars gftp_global_config_vars[] =
    GFTP_CVARS_FLAGS_SHOW_BOOKMARK,
    N_("The number of seconds to keep cache entries before they expire."), 
    GFTP_PORT_ALL, NULL},
+  {"cache_max_entries", N_("Max cache entries:"), 
+   gftp_option_type_int, GINT_TO_POINTER(5000), NULL, 
+   0,
+   N_("The number of directory listings to keep in the cache. When there are more, the ones that were used least recently are removed. Set this to 0 to not limit the size of the cache."), 
+   GFTP_PORT_ALL, NULL},
+  {"max_transfers", N_("Max simultaneous transfers:"), 
+   gftp_option_type_int, GINT_TO_POINTER(0), NULL, 0,
+   N_("The number of transfers in the queue that run at the same time, the others wait until one of them is done. Set this to 1 to do one transfer at a time, or to 0 to start them all at once."), 
+   GFTP_PORT_GTK, NULL},
+  {"transfer_refresh", N_("Transfer status refresh (ms):"), 
+   gftp_option_type_int, GINT_TO_POINTER(250), NULL, 0,
+   N_("How often, in milliseconds, the progress of the transfers is updated on the screen"), 
+   GFTP_PORT_GTK, NULL},
 
   {"append_transfers", N_("Append file transfers"), 
   gftp_option_type_checkbox, GINT_TO_POINTER(1), NULL, 0,
@@ -76,9 +89,6 @@ gftp_config_vars gftp_global_config_vars[] =
   gftp_option_type_checkbox, GINT_TO_POINTER(0), NULL, 0,
    N_("May not look good in some themes"), GFTP_PORT_GTK, NULL},
 
-  {"one_transfer", N_("Do one transfer at a time"), 
-   gftp_option_type_checkbox, GINT_TO_POINTER(0), NULL, 0,
-   N_("Do only one transfer at a time?"), GFTP_PORT_GTK, NULL},
   {"overwrite_default", N_("Overwrite by Default"), 
    gftp_option_type_checkbox, GINT_TO_POINTER(0), NULL, 
    GFTP_CVARS_FLAGS_SHOW_BOOKMARK,
@@ -153,6 +163,21 @@ gftp_config_vars gftp_global_config_vars[] =
    GFTP_CVARS_FLAGS_SHOW_BOOKMARK,
    N_("The block size that is used when transferring files. This should be a multiple of 1024."),  
    GFTP_PORT_ALL, NULL},
+  {"transfer_workers", N_("Connections per transfer:"), 
+   gftp_option_type_int, GINT_TO_POINTER(1), NULL, 
+   GFTP_CVARS_FLAGS_SHOW_BOOKMARK,
+   N_("The number of connections that are opened to transfer the files of a single transfer in parallel. Set this to 1 to transfer one file at a time."),  
+   GFTP_PORT_ALL, NULL},
+  {"transfer_segments", N_("Segments per file:"), 
+   gftp_option_type_int, GINT_TO_POINTER(1), NULL, 
+   GFTP_CVARS_FLAGS_SHOW_BOOKMARK,
+   N_("The number of connections that are used to download a large file from an FTP, SSH2 or HTTP server to the local disk. Each connection fetches a different part of the file. Set this to 1 to download over a single connection."),  
+   GFTP_PORT_ALL, NULL},
+  {"adaptive_blksize", N_("Adapt the block size to the throughput"), 
+   gftp_option_type_checkbox, GINT_TO_POINTER(0), NULL, 
+   GFTP_CVARS_FLAGS_SHOW_BOOKMARK,
+   N_("Grow or shrink the transfer block size, starting at the Transfer Block Size, depending on the measured throughput"),  
+   GFTP_PORT_ALL, NULL},
 
   {"default_protocol", N_("Default Protocol:"),
    gftp_option_type_textcombo, "FTP", NULL, 0,
@@ -286,8 +311,9 @@ GHashTable * gftp_global_options_htable = NULL,
 char gftp_version[] = "gFTP " VERSION;
 
 GList * gftp_file_transfers = NULL, 
-      * gftp_file_transfer_logs = NULL,
       * gftp_options_list = NULL;
+
+gftp_log * gftp_file_transfer_logs = NULL;
       
 gftp_bookmarks_var * gftp_bookmarks = NULL;
 
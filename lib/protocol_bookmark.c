@@ -75,6 +75,7 @@ bookmark_init (gftp_request * request)
   request->transfer_file = NULL;
   request->get_next_file_chunk = NULL;
   request->put_next_file_chunk = NULL;
+  request->get_raw_data_fd = NULL;
   request->end_transfer = NULL;
   request->list_files = NULL;
   request->get_next_file = NULL;
@@ -769,6 +769,10 @@ static void ftp_close_data_connection (gftp_request * request)
       close (ftpdat->data_connection);
       ftpdat->data_connection = -1;
     }
+
+  /* Don't hand what is left of an aborted listing to the next one */
+  if (ftpdat->dataconn_rbuf != NULL)
+    gftp_free_getline_buffer (&ftpdat->dataconn_rbuf);
 }
 
 
@@ -1012,7 +1016,7 @@ static int ftp_accept_active_connection (gftp_request * request)
 }
 
 
-static unsigned int
+unsigned int
 ftp_is_ascii_transfer (gftp_request * request, const char *filename)
 {
   DEBUG_PRINT_FUNC
@@ -1095,6 +1099,9 @@ static int ftp_setup_file_transfer (gftp_request * request,
   if ((ret = ftp_set_data_type (request, filename)) < 0)
     return (ret);
 
+  ftpdat->ascii_cr_pending = 0;
+  ftpdat->ascii_last = '\0';
+
   if (ftpdat->data_connection < 0 && 
       (ret = ftp_data_connection_new (request, 0)) < 0)
     return (ret);
@@ -1396,86 +1403,179 @@ static int ftp_list_files (gftp_request * request)
 }
 
 
+/* The lines of an ASCII transfer end with CRLF on the wire and with LF in
+   the local file. The conversion keeps its state in ftp_protocol_data
+   between the chunks of a file, so a CRLF that is split between two
+   chunks is still converted. The CRs and LFs are looked for with memchr(),
+   which the C library implements with vector instructions, and the runs
+   in between are moved as a whole */
+
+/* Strips the CR of each CRLF in buf in place and returns the new length.
+   A CR that ends buf is held back until the next chunk tells whether an
+   LF follows it, a lone CR is kept */
+static size_t
+ftp_ascii_from_crlf (ftp_protocol_data * ftpdat, char *buf, size_t len)
+{
+  char *src, *dest, *end, *search, *cr;
+  size_t run;
+
+  src = dest = search = buf;
+  end = buf + len;
+  while ((cr = memchr (search, '\r', end - search)) != NULL)
+    {
+      if (cr + 1 == end)
+        {
+          ftpdat->ascii_cr_pending = 1;
+          end = cr;
+          break;
+        }
+
+      search = cr + 1;
+      if (*search != '\n')
+        continue;
+
+      run = cr - src;
+      if (dest != src)
+        memmove (dest, src, run);
+      dest += run;
+      src = search;
+    }
+
+  run = end - src;
+  if (dest != src)
+    memmove (dest, src, run);
+  dest += run;
+
+  return (dest - buf);
+}
+
+
+/* Copies buf to dest with a CR in front of each LF that doesn't already
+   have one and returns the length of dest, which has to have room for
+   twice len bytes */
+static size_t
+ftp_ascii_to_crlf (ftp_protocol_data * ftpdat, const char *buf, size_t len,
+                   char *dest)
+{
+  const char *src, *end, *lf;
+  char *pos;
+  size_t run;
+
+  src = buf;
+  end = buf + len;
+  pos = dest;
+  while ((lf = memchr (src, '\n', end - src)) != NULL)
+    {
+      run = lf - src;
+      memcpy (pos, src, run);
+      pos += run;
+
+      if ((lf > buf ? lf[-1] : ftpdat->ascii_last) != '\r')
+        *pos++ = '\r';
+      *pos++ = '\n';
+      src = lf + 1;
+    }
+
+  run = end - src;
+  memcpy (pos, src, run);
+  pos += run;
+
+  if (len > 0)
+    ftpdat->ascii_last = end[-1];
+
+  return (pos - dest);
+}
+
+
 static ssize_t ftp_get_next_file_chunk (gftp_request * request, char *buf, size_t size)
 {
   //DEBUG_PRINT_FUNC
   ssize_t num_read, ret;
   ftp_protocol_data * ftpdat;
-  int i, j;
+  size_t held;
 
   ftpdat = request->protocol_data;
   if (ftpdat->is_fxp_transfer)
     return (GFTP_ENOTRANS);
 
-  num_read = ftpdat->data_conn_read (request, buf, size, ftpdat->data_connection);
-  if (num_read < 0)
-    return (num_read);
+  if (!ftpdat->is_ascii_transfer)
+    return (ftpdat->data_conn_read (request, buf, size, ftpdat->data_connection));
 
-  ret = num_read;
-  if (ftpdat->is_ascii_transfer)
+  do
     {
-      for (i = 0, j = 0; i < num_read; i++)
+      /* A CR that was held back goes in front of the new data */
+      held = ftpdat->ascii_cr_pending && size > 1 ? 1 : 0;
+
+      num_read = ftpdat->data_conn_read (request, buf + held, size - held,
+                                         ftpdat->data_connection);
+      if (num_read < 0)
+        return (num_read);
+
+      if (held)
         {
-          if (buf[i] != '\r')
-            buf[j++] = buf[i];
-          else
-            ret--;
+          buf[0] = '\r';
+          ftpdat->ascii_cr_pending = 0;
+          if (num_read == 0)
+            return (1);
         }
+
+      ret = ftp_ascii_from_crlf (ftpdat, buf, num_read + held);
     }
+  while (ret == 0 && num_read > 0);
 
   return (ret);
 }
 
 
+static int ftp_get_raw_data_fd (gftp_request * request)
+{
+  DEBUG_PRINT_FUNC
+  ftp_protocol_data * ftpdat;
+
+  ftpdat = request->protocol_data;
+
+  /* The data has to go over the wire as it is on disk: no ASCII
+     conversion and no TLS on the data connection */
+  if (ftpdat->is_fxp_transfer || ftpdat->is_ascii_transfer ||
+      ftpdat->data_conn_read != gftp_fd_read ||
+      ftpdat->data_conn_write != gftp_fd_write)
+    return (-1);
+
+  return (ftpdat->data_connection);
+}
+
+
 static ssize_t ftp_put_next_file_chunk (gftp_request * request, char *buf, size_t size)
 {
   //DEBUG_PRINT_FUNC
   ssize_t num_wrote, ret;
   ftp_protocol_data * ftpdat;
   char *tempstr, *pos;
-  size_t rsize, i, j;
+  size_t rsize, tempsize;
 
   ftpdat = request->protocol_data;
 
   if (ftpdat->is_fxp_transfer)
     return (GFTP_ENOTRANS);
 
+  tempstr = buf;
+  tempsize = 0;
+  rsize = size;
   if (ftpdat->is_ascii_transfer)
     {
-      rsize = size;
-      for (i = 1; i < size; i++)
+      if (memchr (buf, '\n', size) != NULL)
         {
-          if (buf[i] == '\n' && buf[i - 1] != '\r')
-            rsize++;
+          tempsize = size * 2;
+          tempstr = gftp_buffer_get (tempsize);
+          rsize = ftp_ascii_to_crlf (ftpdat, buf, size, tempstr);
         }
-
-      if (rsize != size)
-        {
-          tempstr = g_malloc0 (rsize);
-
-          for (i = 0, j = 0; i < size; i++)
-            {
-              if (i > 0 && buf[i] == '\n' && buf[i - 1] != '\r')
-                tempstr[j++] = '\r';
-              tempstr[j++] = buf[i];
-            }
-        }
-      else
-        tempstr = buf;
-    }
-  else
-    {
-      rsize = size;
-      tempstr = buf;
+      else if (size > 0)
+        ftpdat->ascii_last = buf[size - 1];
     }
 
-  /* I need to ensure that the entire buffer has been transferred properly due
-     to the ascii conversion that may occur. 
-     FIXME - the ascii conversion doesn't occur properly when the \n occurs
-     at the beginning of the buffer. I need to remember the last character
-     in the previous buffer */
-
-  ret = rsize;
+  /* All of the converted data has to be written, the caller only knows
+     about the size of its own buffer */
+  ret = size;
   pos = tempstr;
   while (rsize > 0)
     {
@@ -1492,12 +1592,15 @@ static ssize_t ftp_put_next_file_chunk (gftp_request * request, char *buf, size_
     }
 
   if (tempstr != buf)
-    g_free (tempstr);
+    gftp_buffer_put (tempstr, tempsize);
 
   return (ret);
 }
 
 
+/* The listing is read in blocks of this size and split into lines */
+#define FTP_DIRLIST_BUF_SIZE (64 * 1024)
+
 ssize_t ftp_get_next_dirlist_line (gftp_request * request, int fd,
                                           char *buf, size_t buflen)
 {
@@ -1509,6 +1612,9 @@ ssize_t ftp_get_next_dirlist_line (gftp_request * request, int fd,
 
   ftpdat = request->protocol_data;
 
+  if (ftpdat->dataconn_rbuf == NULL)
+    ftpdat->dataconn_rbuf = gftp_new_getline_buffer (FTP_DIRLIST_BUF_SIZE);
+
   oldread_func = request->read_function;
   request->read_function = ftpdat->data_conn_read;
   len = gftp_get_line (request, &ftpdat->dataconn_rbuf, buf, buflen, fd);
@@ -1523,19 +1629,12 @@ int ftp_get_next_file (gftp_request * request, gftp_file * fle, int fd)
   //DEBUG_PRINT_FUNC
   ftp_protocol_data * ftpdat;
   char tempstr[2048];
-  size_t stlen;
   ssize_t len;
 
   g_return_val_if_fail (request != NULL, GFTP_EFATAL);
   g_return_val_if_fail (fle != NULL, GFTP_EFATAL);
   g_return_val_if_fail (fd > 0, GFTP_EFATAL);
 
-  if (request->last_dir_entry)
-    {
-      g_free (request->last_dir_entry);
-      request->last_dir_entry = NULL;
-    }
-
   ftpdat = request->protocol_data;
 
   if (fd == request->datafd)
@@ -1583,12 +1682,6 @@ int ftp_get_next_file (gftp_request * request, gftp_file * fle, int fd)
     }
   while (1);
 
-  stlen = strlen (tempstr);
-  if (!request->cached)
-    {
-      request->last_dir_entry = g_strdup_printf ("%s\n", tempstr);
-      request->last_dir_entry_len = stlen + 1;
-    }
   return (len);
 }
 
@@ -1903,6 +1996,7 @@ int ftp_init (gftp_request * request)
   request->transfer_file = ftp_transfer_file;
   request->get_next_file_chunk = ftp_get_next_file_chunk;
   request->put_next_file_chunk = ftp_put_next_file_chunk;
+  request->get_raw_data_fd = ftp_get_raw_data_fd;
   request->end_transfer = ftp_end_transfer;
   request->abort_transfer = ftp_abort_transfer;
   request->stat_filename = NULL;
@@ -50,6 +50,8 @@ struct ftp_protocol_data_tag
   int data_connection;
   unsigned int is_ascii_transfer : 1;
   unsigned int is_fxp_transfer : 1;
+  unsigned int ascii_cr_pending : 1; /* Downloaded chunk ended with a CR */
+  char ascii_last;                   /* Last byte of the uploaded chunk */
   int (*auth_tls_start) (gftp_request * request);
   int (*data_conn_tls_start) (gftp_request * request);
   ssize_t (*data_conn_read) (gftp_request * request, void *ptr, size_t size,
@@ -143,16 +143,20 @@ static off_t  http_read_response (gftp_request * request)
 {
    DEBUG_PRINT_FUNC
    http_protocol_data * httpdat;
-   unsigned int chunked;
-   char tempstr[8192];
+   unsigned int chunked, has_content_length;
+   off_t content_length;
+   char tempstr[HTTP_HEADER_BUF_SIZE];
+   size_t len;
    int ret;
 
    httpdat = request->protocol_data;
    *tempstr = '\0';
-   chunked = 0;
+   chunked = has_content_length = 0;
+   content_length = 0;
    httpdat->chunk_size = 0;
    httpdat->content_length = 0;
-   httpdat->eof = 0;
+   httpdat->has_content_length = 0;
+   httpdat->chunked_transfer = 0;
 
    if (request->last_ftp_response)
    {
@@ -160,72 +164,88 @@ static off_t  http_read_response (gftp_request * request)
       request->last_ftp_response = NULL;
    }
 
-   if (httpdat->extra_read_buffer != NULL)
-   {
-      g_free (httpdat->extra_read_buffer);
-      httpdat->extra_read_buffer = NULL;
-      httpdat->extra_read_buffer_len = 0;
-   }
-
    do
    {
       if ((ret = gftp_get_line (request, &httpdat->rbuf, tempstr, 
                                 sizeof (tempstr), request->datafd)) < 0)
         return (ret);
+      else if (ret == 0)
+      {
+         /* The server closed the connection before the end of the headers */
+         gftp_disconnect (request);
+         return (GFTP_ERETRYABLE);
+      }
 
       if (request->last_ftp_response == NULL)
+      {
          request->last_ftp_response = g_strdup (tempstr);
 
+         /* HTTP/1.1 connections stay open unless the server says otherwise */
+         httpdat->keep_alive = strncmp (tempstr, "HTTP/1.1", 8) == 0;
+      }
+
       if (*tempstr != '\0')
       {
          request->logging_function (gftp_logging_recv, request, "%s\n", tempstr);
          if (strncmp (tempstr, "Content-Length:", 15) == 0)
-            httpdat->content_length = gftp_parse_file_size (tempstr + 16);
+         {
+            content_length = gftp_parse_file_size (tempstr + 16);
+            has_content_length = 1;
+         }
          else if (strcmp (tempstr, "Transfer-Encoding: chunked") == 0)
             chunked = 1;
+         else if (strncasecmp (tempstr, "Connection:", 11) == 0)
+         {
+            if (strstr (tempstr + 11, "close") != NULL)
+               httpdat->keep_alive = 0;
+            else if (strstr (tempstr + 11, "keep-alive") != NULL)
+               httpdat->keep_alive = 1;
+         }
       }
    } while (*tempstr != '\0');
 
+   /* Only limit the reads to the body once all of the headers are in */
+   httpdat->content_length = content_length;
+   httpdat->has_content_length = has_content_length;
+
    if (chunked)
    {
-      if ((ret = gftp_get_line (request, &httpdat->rbuf, tempstr, 
-                              sizeof (tempstr), request->datafd)) < 0)
-         return (ret);
-      if (sscanf (tempstr, GFTP_OFF_T_HEX_PRINTF_MOD, &httpdat->chunk_size) != 1)
-      {
-         request->logging_function (gftp_logging_recv, request,
-                                    _("Received wrong response from server, disconnecting\nInvalid chunk size '%s' returned by the remote server\n"), 
-                                    tempstr);
-         gftp_disconnect (request);
-         return (GFTP_EFATAL);
-      }
-      if (httpdat->chunk_size == 0) {
-         return (0);
-      }
-      httpdat->chunk_size -= httpdat->rbuf->cur_bufsize;
-      if (httpdat->chunk_size < 0)
+      /* Whatever was read past the headers goes through the chunk decoder.
+         The header line buffer is never bigger than raw_buf */
+      len = 0;
+      if (httpdat->rbuf != NULL)
       {
-         httpdat->extra_read_buffer_len = httpdat->chunk_size * -1;
-         httpdat->chunk_size = 0;
-         httpdat->extra_read_buffer = g_malloc0 ((gulong) httpdat->extra_read_buffer_len + 1);
-         memcpy (httpdat->extra_read_buffer, httpdat->rbuf->curpos + (httpdat->rbuf->cur_bufsize - httpdat->extra_read_buffer_len), httpdat->extra_read_buffer_len);
-         httpdat->extra_read_buffer[httpdat->extra_read_buffer_len] = '\0';
-         httpdat->rbuf->cur_bufsize -= httpdat->extra_read_buffer_len;
-         httpdat->rbuf->curpos[httpdat->rbuf->cur_bufsize] = '\0';
+         len = httpdat->rbuf->cur_bufsize;
+         if (len > sizeof (httpdat->raw_buf))
+            len = sizeof (httpdat->raw_buf);
+         memcpy (httpdat->raw_buf, httpdat->rbuf->curpos, len);
+         gftp_free_getline_buffer (&httpdat->rbuf);
       }
+
+      httpdat->raw_pos = 0;
+      httpdat->raw_len = len;
+      httpdat->chunk_state = HTTP_CHUNK_SIZE;
+      httpdat->chunk_digits = 0;
+      httpdat->read_bytes = 0;
+   }
+   else
+   {
+      /* The start of the body may have been read along with the headers */
+      httpdat->read_bytes = httpdat->rbuf != NULL ? httpdat->rbuf->cur_bufsize : 0;
    }
 
    httpdat->chunked_transfer = chunked;
-   return (httpdat->content_length > 0 ? httpdat->content_length : httpdat->chunk_size);
+   return (httpdat->content_length);
 }
 
 
-static off_t http_send_command (gftp_request * request, const char *command)
+static off_t http_send_request (gftp_request * request, const char *command)
 {
    DEBUG_PRINT_FUNC
    char *tempstr, *str, *proxy_hostname, *proxy_username, *proxy_password;
    tempstr = str = proxy_hostname = proxy_username = proxy_password = NULL;
    ///intptr_t proxy_port = 0;
+   GString * headers;
    int conn_ret;
    ssize_t ret;
 
@@ -235,19 +255,15 @@ static off_t http_send_command (gftp_request * request, const char *command)
    if (request->datafd < 0 && (conn_ret = http_connect (request)) != 0)
       return (conn_ret);
 
-   tempstr = g_strdup_printf ("%sUser-Agent: %s\r\nHost: %s\r\nAccept: */*\r\nAccept-Encoding: identity\r\n\r\n",
-                             (char *) command, gftp_version, request->hostname);
+   /* The connection is kept open between requests, so all of the headers
+      and the blank line that ends them have to go out together. Anything
+      after the blank line would be read as the start of the next request */
+   headers = g_string_new (NULL);
+   g_string_printf (headers, "%sUser-Agent: %s\r\nHost: %s\r\nAccept: */*\r\nAccept-Encoding: identity\r\n",
+                    (char *) command, gftp_version, request->hostname);
 
    request->logging_function (gftp_logging_send, request,
-                             "%s", tempstr);
-
-   ret = request->write_function (request, tempstr, strlen (tempstr), 
-                                 request->datafd);
-   g_free (tempstr);
-
-   if (ret < 0) {
-      return (ret);
-   }
+                             "%s", headers->str);
 
    ///gftp_lookup_request_option (request, "http_proxy_host", &proxy_hostname);
    ///gftp_lookup_request_option (request, "http_proxy_port", &proxy_port);
@@ -262,11 +278,8 @@ static off_t http_send_command (gftp_request * request, const char *command)
 
       request->logging_function (gftp_logging_send, request,
                                  "Proxy-authorization: Basic xxxx:xxxx\n");
-      ret = gftp_writefmt (request, request->datafd, 
-                           "Proxy-authorization: Basic %s\n", str);
+      g_string_append_printf (headers, "Proxy-authorization: Basic %s\r\n", str);
       if (str) free (str);
-      if (ret < 0)
-        return (ret);
    }
 
    if (request->username != NULL && *request->username != '\0')
@@ -277,30 +290,75 @@ static off_t http_send_command (gftp_request * request, const char *command)
 
       request->logging_function (gftp_logging_send, request,
                                  "Authorization: Basic xxxx\n");
-      ret = gftp_writefmt (request, request->datafd, 
-                           "Authorization: Basic %s\n", str);
+      g_string_append_printf (headers, "Authorization: Basic %s\r\n", str);
       if (str) free (str);
-      if (ret < 0)
-        return (ret);
    }
 
-   if ((ret = request->write_function (request, "\n", 1, request->datafd)) < 0) {
+   g_string_append (headers, "\r\n");
+   ret = request->write_function (request, headers->str, headers->len,
+                                 request->datafd);
+   g_string_free (headers, TRUE);
+
+   if (ret < 0) {
       return (ret);
    }
    return (http_read_response (request));
 }
 
 
+static off_t http_send_command (gftp_request * request, const char *command)
+{
+   DEBUG_PRINT_FUNC
+   int reused;
+   off_t ret;
+
+   g_return_val_if_fail (request != NULL, GFTP_EFATAL);
+
+   if (request->last_ftp_response)
+   {
+      g_free (request->last_ftp_response);
+      request->last_ftp_response = NULL;
+   }
+
+   reused = request->datafd > 0;
+   ret = http_send_request (request, command);
+
+   /* The server may close a connection that was kept open at any time. Try
+      again once on a new connection if it did so before answering */
+   if (ret < 0 && reused && request->last_ftp_response == NULL)
+   {
+      request->logging_function (gftp_logging_misc, request,
+                                 _("The server closed the connection, reconnecting\n"));
+      gftp_disconnect (request);
+      ret = http_send_request (request, command);
+   }
+
+   return (ret);
+}
+
+
 static void http_disconnect (gftp_request * request)
 {
    DEBUG_PRINT_FUNC
+   http_protocol_data * httpdat;
+
    g_return_if_fail (request != NULL);
 
+   /* Nothing that was read from the old connection belongs to the next one */
+   httpdat = request->protocol_data;
+   if (httpdat != NULL && httpdat->rbuf != NULL)
+      gftp_free_getline_buffer (&httpdat->rbuf);
+   if (httpdat != NULL)
+      httpdat->raw_pos = httpdat->raw_len = 0;
+
    if (request->datafd > 0)
    {
       request->logging_function (gftp_logging_misc, request,
                                  _("Disconnecting from site %s\n"),
                                  request->hostname);
+#ifdef USE_SSL
+      gftp_ssl_session_close (request);
+#endif
       if (close (request->datafd) < 0)
         request->logging_function (gftp_logging_error, request,
                                    _("Error closing file descriptor: %s\n"),
@@ -316,7 +374,6 @@ static off_t http_get_file (gftp_request * request, const char *filename,
 {
    DEBUG_PRINT_FUNC
    char *tempstr, *oldstr, *hf;
-   http_protocol_data * httpdat;
    ///intptr_t use_http11 = 1;
    int restarted;
    size_t len;
@@ -325,7 +382,6 @@ static off_t http_get_file (gftp_request * request, const char *filename,
    g_return_val_if_fail (request != NULL, GFTP_EFATAL);
    g_return_val_if_fail (filename != NULL, GFTP_EFATAL);
 
-   httpdat = request->protocol_data;
    ///gftp_lookup_request_option (request, "use_http11", &use_http11);
 
    hf = g_strconcat ("/", filename, NULL);
@@ -337,7 +393,14 @@ static off_t http_get_file (gftp_request * request, const char *filename,
    }
    g_free (hf);
 
-   if (startsize > 0)
+   if (request->range_end > 0)
+   {
+      oldstr = tempstr;
+      tempstr = g_strdup_printf ("%sRange: bytes=" GFTP_OFF_T_PRINTF_MOD "-" GFTP_OFF_T_PRINTF_MOD "\n",
+                                 tempstr, startsize, request->range_end - 1);
+      g_free (oldstr);
+   }
+   else if (startsize > 0)
    {
       request->logging_function (gftp_logging_misc, request,
                                  _("Starting the file transfer at offset " GFTP_OFF_T_PRINTF_MOD "\n"),
@@ -358,15 +421,23 @@ static off_t http_get_file (gftp_request * request, const char *filename,
    len = strlen (request->last_ftp_response);
    if (len  > 9 && strncmp (request->last_ftp_response + 9, "206", 3) == 0)
       restarted = 1;
+   else if (request->range_end > 0 && len > 9 &&
+            strncmp (request->last_ftp_response + 9, "200", 3) == 0)
+   {
+      /* Only a part of the file was asked for */
+      gftp_disconnect (request);
+      return (GFTP_ENORANGE);
+   }
    else if (len < 9 || strncmp (request->last_ftp_response + 9, "200", 3) != 0)
    {
       request->logging_function (gftp_logging_error, request,
                                  _("Cannot retrieve file %s\n"), filename);
+
+      /* The body of the error page is still on the connection */
+      gftp_disconnect (request);
       return (GFTP_ERETRYABLE);
    }
 
-   httpdat->read_bytes = 0;
-
    return (restarted ? size + startsize : size);
 }
 
@@ -404,19 +475,36 @@ static int http_end_transfer (gftp_request * request)
 {
    DEBUG_PRINT_FUNC
    http_protocol_data * httpdat;
+   int body_done;
 
    g_return_val_if_fail (request != NULL, GFTP_EFATAL);
 
    if (request->datafd < 0) {
       return (GFTP_EFATAL);
    }
-   gftp_disconnect (request);
 
    httpdat = request->protocol_data;
+
+   /* Keep the connection for the next request if the whole body was read
+      and the server didn't ask to close it */
+   if (httpdat->chunked_transfer)
+      body_done = httpdat->chunk_state == HTTP_CHUNK_DONE &&
+                  httpdat->raw_pos == httpdat->raw_len;
+   else
+      body_done = httpdat->has_content_length &&
+                  httpdat->read_bytes == httpdat->content_length;
+
+   if (!httpdat->keep_alive || !body_done ||
+       (httpdat->rbuf != NULL && httpdat->rbuf->cur_bufsize > 0))
+      gftp_disconnect (request);
+   else if (httpdat->rbuf != NULL)
+      gftp_free_getline_buffer (&httpdat->rbuf);
+
    httpdat->content_length = 0;
+   httpdat->has_content_length = 0;
    httpdat->chunked_transfer = 0;
    httpdat->chunk_size = 0;
-   httpdat->eof = 0;
+   httpdat->raw_pos = httpdat->raw_len = 0;
 
    return (0);
 }
@@ -425,14 +513,12 @@ static int http_end_transfer (gftp_request * request)
 static int http_list_files (gftp_request * request)
 {
    DEBUG_PRINT_FUNC
-   http_protocol_data *httpdat;
    char *tempstr, *hd;
    ///intptr_t use_http11 = 1;
    off_t ret;
 
    g_return_val_if_fail (request != NULL, GFTP_EFATAL);
 
-   httpdat = request->protocol_data;
    ///gftp_lookup_request_option (request, "use_http11", &use_http11);
 
    if (strncmp (request->directory, "/", strlen (request->directory)) == 0) {
@@ -452,7 +538,6 @@ static int http_list_files (gftp_request * request)
    if (ret < 0) {
       return ((int) ret);
    }
-   httpdat->read_bytes = 0;
    if (strlen (request->last_ftp_response) > 9 &&
       strncmp (request->last_ftp_response + 9, "200", 3) == 0)
    {
@@ -634,11 +719,6 @@ int http_get_next_file (gftp_request * request, gftp_file * fle, int fd)
    g_return_val_if_fail (fle != NULL, GFTP_EFATAL);
 
    httpdat = request->protocol_data;
-   if (request->last_dir_entry)
-   {
-      g_free (request->last_dir_entry);
-      request->last_dir_entry = NULL;
-   }
 
    if (fd < 0)
       fd = request->datafd;
@@ -661,12 +741,6 @@ int http_get_next_file (gftp_request * request, gftp_file * fle, int fd)
    }
 
    len = strlen (tempstr);
-   if (!request->cached)
-   {
-      request->last_dir_entry = g_strdup_printf ("%s\n", tempstr);
-      request->last_dir_entry_len = len + 1;
-   }
-
    return (len);
 }
 
@@ -720,189 +794,206 @@ static void http_destroy (gftp_request * request)
    if (httpdat->rbuf != NULL) {
       gftp_free_getline_buffer (&httpdat->rbuf);
    }
-   if (httpdat->extra_read_buffer != NULL)
+}
+
+
+/* Steps the chunk decoder over the framing bytes in raw_buf: the chunk size
+   line, the CRLF after the payload and the trailer. Stops at the start of
+   the payload or at the end of the body */
+
+static int http_chunk_parse (gftp_request * request, http_protocol_data * httpdat)
+{
+   int digit;
+   char c;
+
+   while (httpdat->raw_pos < httpdat->raw_len &&
+          httpdat->chunk_state != HTTP_CHUNK_DATA &&
+          httpdat->chunk_state != HTTP_CHUNK_DONE)
    {
-      g_free (httpdat->extra_read_buffer);
-      httpdat->extra_read_buffer = NULL;
-      httpdat->extra_read_buffer_len = 0;
+      c = httpdat->raw_buf[httpdat->raw_pos++];
+      switch (httpdat->chunk_state)
+      {
+         case HTTP_CHUNK_SIZE:
+            if ((digit = g_ascii_xdigit_value (c)) >= 0)
+            {
+               /* Don't let the size overflow off_t */
+               if (httpdat->chunk_size >= (off_t) 1 << (sizeof (off_t) * 8 - 5))
+                  goto bad_chunk_size;
+               httpdat->chunk_size = httpdat->chunk_size * 16 + digit;
+               httpdat->chunk_digits++;
+               continue;
+            }
+            else if (httpdat->chunk_digits == 0)
+               goto bad_chunk_size;
+            else if (c == ';' || c == ' ' || c == '\t')
+               httpdat->chunk_state = HTTP_CHUNK_EXT;
+            else if (c == '\r')
+               httpdat->chunk_state = HTTP_CHUNK_SIZE_LF;
+            else if (c == '\n')
+               break;
+            else
+               goto bad_chunk_size;
+            continue;
+         case HTTP_CHUNK_EXT:
+            if (c == '\r')
+               httpdat->chunk_state = HTTP_CHUNK_SIZE_LF;
+            else if (c == '\n')
+               break;
+            continue;
+         case HTTP_CHUNK_SIZE_LF:
+            if (c == '\n')
+               break;
+            goto bad_chunk_size;
+         case HTTP_CHUNK_DATA_CR:
+            if (c == '\r')
+               httpdat->chunk_state = HTTP_CHUNK_DATA_LF;
+            else if (c == '\n')
+               httpdat->chunk_state = HTTP_CHUNK_SIZE;
+            else
+               goto bad_response;
+            continue;
+         case HTTP_CHUNK_DATA_LF:
+            if (c != '\n')
+               goto bad_response;
+            httpdat->chunk_state = HTTP_CHUNK_SIZE;
+            continue;
+         case HTTP_CHUNK_TRAILER:
+            if (c == '\n')
+            {
+               if (httpdat->trailer_len == 0)
+                  httpdat->chunk_state = HTTP_CHUNK_DONE;
+               httpdat->trailer_len = 0;
+            }
+            else if (c != '\r')
+               httpdat->trailer_len++;
+            continue;
+      }
+
+      /* End of the chunk size line */
+      httpdat->chunk_digits = 0;
+      if (httpdat->chunk_size == 0)
+      {
+         httpdat->chunk_state = HTTP_CHUNK_TRAILER;
+         httpdat->trailer_len = 0;
+      }
+      else
+         httpdat->chunk_state = HTTP_CHUNK_DATA;
    }
+
+   return (0);
+
+bad_chunk_size:
+   request->logging_function (gftp_logging_recv, request,
+                              _("Received wrong response from server, disconnecting\nInvalid chunk size returned by the remote server\n"));
+   return (GFTP_EFATAL);
+
+bad_response:
+   request->logging_function (gftp_logging_error, request,
+                              _("Received wrong response from server, disconnecting\n"));
+   return (GFTP_EFATAL);
 }
 
 
+/* Reads the body of the response. Chunk payloads are read straight into
+   ptr, only the framing between them goes through raw_buf */
+
 static ssize_t http_chunked_read (gftp_request * request, void *ptr, size_t size, int fd)
 {
    DEBUG_PRINT_FUNC
-   size_t read_size, begin_ptr_len, current_size, crlfsize;
    http_protocol_data * httpdat;
-   char *stpos, *crlfpos;
-   void *read_ptr_pos;
+   size_t read_size, copied;
    ssize_t retval;
-   size_t sret;
+   int ret;
 
    httpdat = request->protocol_data;
-   httpdat->read_ref_cnt++;
-
-   if (httpdat->extra_read_buffer != NULL)
-   {
-      g_return_val_if_fail (httpdat->extra_read_buffer_len <= size, GFTP_EFATAL);
-
-      memcpy (ptr, httpdat->extra_read_buffer, httpdat->extra_read_buffer_len);
-
-      begin_ptr_len = httpdat->extra_read_buffer_len;
-      read_ptr_pos = (char *) ptr + begin_ptr_len;
 
-      /* Check for end of chunk */
-      if (begin_ptr_len > 5 && strncmp ("\r\n0\r\n", (char *) ptr, 5) == 0)
-         read_size = 0;
-      else
-         read_size = size - begin_ptr_len;
-
-      g_free (httpdat->extra_read_buffer);
-      httpdat->extra_read_buffer = NULL;
-      httpdat->extra_read_buffer_len = 0;
-   }
-   else
+   if (!httpdat->chunked_transfer)
    {
-      begin_ptr_len = 0;
-      read_ptr_pos = ptr;
-
       read_size = size;
-      if (httpdat->content_length > 0)
+      if (httpdat->has_content_length)
       {
-         if (httpdat->content_length == (off_t) httpdat->read_bytes)
-         {
-             httpdat->read_ref_cnt--;
-             return (0);
-          }
-
-          if ((off_t) read_size + httpdat->read_bytes > httpdat->content_length)
-              read_size = httpdat->content_length - httpdat->read_bytes;
-      }
-      else if (httpdat->chunked_transfer && httpdat->chunk_size > 0 &&
-               httpdat->chunk_size < (off_t) read_size)
-         read_size = httpdat->chunk_size;
-   }
+         if (httpdat->read_bytes >= httpdat->content_length)
+            return (0);
 
-   if (read_size > 0 && !httpdat->eof)
-   {
-      if (size == read_size)
-          read_size--; /* decrement by one so that we can put the NUL character
-                          in the buffer */
-      retval = httpdat->real_read_function (request, read_ptr_pos, read_size, fd);
-      if (retval <= 0)
-      {
-         httpdat->read_ref_cnt--;
-         return (retval);
+         if ((off_t) read_size > httpdat->content_length - httpdat->read_bytes)
+            read_size = httpdat->content_length - httpdat->read_bytes;
       }
 
-      httpdat->read_bytes += retval;
-      if (httpdat->chunk_size > 0)
-      {
-         httpdat->chunk_size -= retval;
-         httpdat->read_ref_cnt--;
-         return (retval);
-      }
-
-      sret = retval + begin_ptr_len;
+      retval = httpdat->real_read_function (request, ptr, read_size, fd);
+      if (retval > 0)
+         httpdat->read_bytes += retval;
+      return (retval);
    }
-   else
-      sret = begin_ptr_len;
-
-   ((char *) ptr)[sret] = '\0';
 
-   if (!httpdat->chunked_transfer)
+   copied = 0;
+   while (copied < size && httpdat->chunk_state != HTTP_CHUNK_DONE)
    {
-      httpdat->read_ref_cnt--;
-      return (sret);
-   }
-
-   stpos = (char *) ptr;
-   while (httpdat->chunk_size == 0)
-   {
-      current_size = sret - (stpos - (char *) ptr);
-      if (current_size == 0)
-         break;
-
-      if (*stpos == '\r' && *(stpos + 1) == '\n')
-         crlfpos = strstr (stpos + 2, "\r\n");
-      else
-         crlfpos = NULL;
-
-      if (crlfpos == NULL)
+      if (httpdat->chunk_state == HTTP_CHUNK_DATA)
       {
-         /* The current chunk size is split between multiple packets.
-            Save this chunk and read the next */
-         httpdat->extra_read_buffer = g_malloc0 ((gulong) current_size + 1);
-         memcpy (httpdat->extra_read_buffer, stpos, current_size);
-         httpdat->extra_read_buffer[current_size] = '\0';
-         httpdat->extra_read_buffer_len = current_size;
-         sret -= current_size;
-
-         if (sret == 0)
-         {
-            /* Don't let a hostile web server send us in an infinite recursive loop */
-            if (httpdat->read_ref_cnt > 2)
-            {
-               request->logging_function (gftp_logging_error, request, _("Received wrong response from server, disconnecting\n"));
-               gftp_disconnect (request);
-               httpdat->read_ref_cnt--;
-               return (GFTP_EFATAL);
-            }
+         read_size = size - copied;
+         if ((off_t) read_size > httpdat->chunk_size)
+            read_size = httpdat->chunk_size;
 
-            retval = http_chunked_read (request, ptr, size, fd);
-            if (retval < 0) {
+         if (httpdat->raw_pos < httpdat->raw_len)
+         {
+            if (read_size > httpdat->raw_len - httpdat->raw_pos)
+               read_size = httpdat->raw_len - httpdat->raw_pos;
+            memcpy ((char *) ptr + copied, httpdat->raw_buf + httpdat->raw_pos,
+                    read_size);
+            httpdat->raw_pos += read_size;
+            retval = read_size;
+         }
+         else if (copied > 0)
+            break; /* Don't wait on the socket with data for the caller */
+         else
+         {
+            retval = httpdat->real_read_function (request, ptr, read_size, fd);
+            if (retval < 0)
                return (retval);
-             }
-             sret = retval;
+            else if (retval == 0)
+               goto premature_eof;
          }
 
-         httpdat->read_ref_cnt--;
-         return (sret);
-      }
-
-      *crlfpos = '\0';
-      crlfpos++; /* advance to line feed */
-
-      if (sscanf (stpos + 2, GFTP_OFF_T_HEX_PRINTF_MOD,
-                  &httpdat->chunk_size) != 1)
-      {
-         request->logging_function (gftp_logging_recv, request,
-                                     _("Received wrong response from server, disconnecting\nInvalid chunk size '%s' returned by the remote server\n"), 
-                                     stpos + 2);
-         gftp_disconnect (request);
-         httpdat->read_ref_cnt--;
-         return (GFTP_EFATAL);
+         copied += retval;
+         httpdat->read_bytes += retval;
+         httpdat->chunk_size -= retval;
+         if (httpdat->chunk_size == 0)
+            httpdat->chunk_state = HTTP_CHUNK_DATA_CR;
+         continue;
       }
 
-      crlfsize = crlfpos - stpos + 1;
-      sret -= crlfsize;
-      current_size -= crlfsize;
-
-      if (httpdat->chunk_size == 0)
+      if (httpdat->raw_pos == httpdat->raw_len)
       {
-         if (httpdat->eof)
-         {
-            httpdat->read_ref_cnt--;
-            return (0);
-         }
-         httpdat->eof = 1;
-         httpdat->read_ref_cnt--;
-         return (sret);
+         if (copied > 0)
+            break;
+
+         /* Only read a little past the framing, the payload after it
+            should go straight to the caller */
+         httpdat->raw_pos = 0;
+         httpdat->raw_len = 0;
+         retval = httpdat->real_read_function (request, httpdat->raw_buf,
+                                               HTTP_CHUNK_FRAME_READ, fd);
+         if (retval < 0)
+            return (retval);
+         else if (retval == 0)
+            goto premature_eof;
+         httpdat->raw_len = retval;
       }
 
-      memmove (stpos, crlfpos + 1, current_size + 1);
-
-      if (httpdat->chunk_size < (off_t) current_size)
+      if ((ret = http_chunk_parse (request, httpdat)) < 0)
       {
-         stpos += httpdat->chunk_size;
-         httpdat->chunk_size = 0;
+         gftp_disconnect (request);
+         return (ret);
       }
-      else
-         httpdat->chunk_size -= current_size;
    }
 
-   httpdat->read_ref_cnt--;
-   return (sret);
+   return (copied);
+
+premature_eof:
+   request->logging_function (gftp_logging_error, request,
+                              _("Received wrong response from server, disconnecting\n"));
+   gftp_disconnect (request);
+   return (GFTP_ERETRYABLE);
 }
 
 
@@ -936,6 +1027,7 @@ int http_init (gftp_request * request)
    request->transfer_file = NULL;
    request->get_next_file_chunk = http_get_next_file_chunk;
    request->put_next_file_chunk = NULL;
+   request->get_raw_data_fd = NULL;
    request->end_transfer = http_end_transfer;
    request->abort_transfer = http_end_transfer; /* NOTE: uses end_transfer */
    request->stat_filename = NULL;
@@ -956,7 +1048,9 @@ int http_init (gftp_request * request)
    request->need_username = 0;
    request->need_password = 0;
    request->use_cache = 1;
-   request->always_connected = 1;
+   /* The connection outlives a request, so gftp_swap_socks() has to hand
+      it over instead of sharing it */
+   request->always_connected = 0;
    request->use_local_encoding = 0;
 
    request->protocol_data = g_malloc0 (sizeof (http_protocol_data));
@@ -22,6 +22,26 @@
 /***********************************************************************************/
 
 
+/* Size of the buffer the response headers are read with */
+#define HTTP_HEADER_BUF_SIZE 8192
+
+/* How much the chunk decoder reads at a time when it looks for the next
+   chunk size line */
+#define HTTP_CHUNK_FRAME_READ 64
+
+/* States of the chunked transfer decoder, see http_chunked_read() */
+enum
+{
+   HTTP_CHUNK_SIZE,      /* Hex digits of the chunk size */
+   HTTP_CHUNK_EXT,       /* Chunk extension up to the end of the line */
+   HTTP_CHUNK_SIZE_LF,   /* \n that ends the chunk size line */
+   HTTP_CHUNK_DATA,      /* chunk_size bytes of payload */
+   HTTP_CHUNK_DATA_CR,   /* \r\n after the payload */
+   HTTP_CHUNK_DATA_LF,
+   HTTP_CHUNK_TRAILER,   /* Trailer lines up to an empty line */
+   HTTP_CHUNK_DONE
+};
+
 typedef struct http_protocol_data_tag
 {
    gftp_getline_buffer * rbuf;
@@ -29,14 +49,19 @@ typedef struct http_protocol_data_tag
    off_t chunk_size;
    off_t content_length;
    unsigned int chunked_transfer : 1;
-   unsigned int eof : 1;
+   unsigned int has_content_length : 1;
+   unsigned int keep_alive : 1; /* The connection can be used for the next request */
+   int chunk_state;
+   size_t chunk_digits;  /* Hex digits seen on the chunk size line */
+   size_t trailer_len;   /* Length of the current trailer line */
    ssize_t (*real_read_function) (gftp_request * request,
                                   void *ptr,
                                   size_t size,
                                   int fd);
-   int read_ref_cnt;
-   char * extra_read_buffer;
-   size_t extra_read_buffer_len;
+   /* Bytes from the connection that the chunked decoder has not used yet */
+   char raw_buf[HTTP_HEADER_BUF_SIZE];
+   size_t raw_pos;
+   size_t raw_len;
 
 } http_protocol_data;
 
@@ -268,6 +268,70 @@ static int localfs_put_file (gftp_request * request, const char *filename,
 }
 
 
+/* Opens the destination of a segmented download. The segments are
+   written with pwrite() on request->datafd, so the file is not truncated
+   when truncate_size is negative to keep the ranges of an earlier try */
+int
+localfs_open_segmented_file (gftp_request * request, const char *filename,
+                             off_t truncate_size)
+{
+  DEBUG_PRINT_FUNC
+  int flags, perms;
+  size_t destlen;
+  char *utf8;
+
+  g_return_val_if_fail (request != NULL, GFTP_EFATAL);
+  g_return_val_if_fail (request->protonum == GFTP_PROTOCOL_LOCALFS, GFTP_EFATAL);
+  g_return_val_if_fail (filename != NULL, GFTP_EFATAL);
+
+  flags = O_WRONLY | O_CREAT;
+#if defined (_LARGEFILE_SOURCE) && defined (O_LARGEFILE)
+  flags |= O_LARGEFILE;
+#endif
+
+  perms = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+  utf8 = gftp_filename_from_utf8 (request, filename, &destlen);
+  if (utf8 != NULL)
+    {
+      request->datafd = gftp_fd_open (request, utf8, flags, perms);
+      g_free (utf8);
+    }
+  else
+    request->datafd = gftp_fd_open (request, filename, flags, perms);
+
+  if (request->datafd == -1)
+    return (GFTP_ERETRYABLE);
+
+  if (truncate_size >= 0 && ftruncate (request->datafd, truncate_size) == -1)
+    {
+      request->logging_function (gftp_logging_error, request,
+                               _("Error: Cannot truncate local file %s: %s\n"),
+                               filename, g_strerror (errno));
+      gftp_disconnect (request);
+      return (GFTP_ERETRYABLE);
+    }
+
+  return (0);
+}
+
+
+static int localfs_get_raw_data_fd (gftp_request * request)
+{
+  DEBUG_PRINT_FUNC
+  int flags;
+
+  if (request->datafd <= 0)
+    return (-1);
+
+  /* splice() refuses files that are opened for appending */
+  if ((flags = fcntl (request->datafd, F_GETFL, 0)) < 0 ||
+      (flags & O_APPEND))
+    return (-1);
+
+  return (request->datafd);
+}
+
+
 static int localfs_end_transfer (gftp_request * request)
 {
   DEBUG_PRINT_FUNC
@@ -731,6 +795,7 @@ int localfs_init (gftp_request * request)
   request->transfer_file = NULL;
   request->get_next_file_chunk = NULL;
   request->put_next_file_chunk = NULL;
+  request->get_raw_data_fd = localfs_get_raw_data_fd;
   request->end_transfer = localfs_end_transfer;
   request->abort_transfer = localfs_end_transfer; /* NOTE: uses end_transfer */
   request->stat_filename = localfs_stat_filename;
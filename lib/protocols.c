@@ -56,6 +56,9 @@ void gftp_request_destroy (gftp_request * request, int free_request)
   if (request->protocol_data)     g_free (request->protocol_data);
   if (request->remote_addr)       g_free (request->remote_addr);
 
+  gftp_finish_cache_entry (request, 0);
+  gftp_release_cache_entry (request);
+
   if (request->local_options_vars != NULL)
     {
       gftp_config_free_options (request->local_options_vars,
@@ -104,6 +107,7 @@ void gftp_file_destroy (gftp_file * file, int free_it)
   if (file->user_data && file->free_user_data) {
       g_free (file->user_data);
   }
+  if (file->segments) g_free (file->segments);
 
   if (free_it && file)
     g_free (file);
@@ -291,6 +295,67 @@ gftp_put_next_file_chunk (gftp_request * request, char *buf, size_t size)
 }
 
 
+/* Returns 1 when the data of the file that is being transferred between
+   the local disk and the other side can be moved by the kernel with
+   gftp_zero_copy_file_chunk() */
+int
+gftp_can_zero_copy (gftp_request * fromreq, gftp_request * toreq)
+{
+  DEBUG_PRINT_FUNC
+#ifdef HAVE_SENDFILE_SPLICE
+  g_return_val_if_fail (fromreq != NULL, 0);
+  g_return_val_if_fail (toreq != NULL, 0);
+
+  if ((fromreq->protonum == GFTP_PROTOCOL_LOCALFS) ==
+      (toreq->protonum == GFTP_PROTOCOL_LOCALFS))
+    return (0);
+
+  if (fromreq->get_raw_data_fd == NULL || toreq->get_raw_data_fd == NULL)
+    return (0);
+
+  return (fromreq->get_raw_data_fd (fromreq) >= 0 &&
+          toreq->get_raw_data_fd (toreq) >= 0);
+#else
+  return (0);
+#endif
+}
+
+
+/* pipefd has to be initialized to -1 by the caller, the pipe is created
+   on the first download chunk and has to be closed by the caller */
+ssize_t
+gftp_zero_copy_file_chunk (gftp_request * fromreq, gftp_request * toreq,
+                           int *pipefd, size_t size)
+{
+  //DEBUG_PRINT_FUNC
+#ifdef HAVE_SENDFILE_SPLICE
+  int fromfd, tofd;
+
+  g_return_val_if_fail (fromreq != NULL, GFTP_EFATAL);
+  g_return_val_if_fail (toreq != NULL, GFTP_EFATAL);
+
+  fromfd = fromreq->get_raw_data_fd (fromreq);
+  tofd = toreq->get_raw_data_fd (toreq);
+
+  if (fromreq->protonum == GFTP_PROTOCOL_LOCALFS)
+    return (gftp_fd_sendfile (toreq, fromfd, tofd, size));
+
+  if (pipefd[0] < 0 && pipe (pipefd) == -1)
+    {
+      fromreq->logging_function (gftp_logging_error, fromreq,
+                                 _("Cannot create a pipe: %s\n"),
+                                 g_strerror (errno));
+      pipefd[0] = pipefd[1] = -1;
+      return (GFTP_ERETRYABLE);
+    }
+
+  return (gftp_fd_splice (fromreq, fromfd, tofd, pipefd, size));
+#else
+  return (GFTP_EFATAL);
+#endif
+}
+
+
 int
 gftp_end_transfer (gftp_request * request)
 {
@@ -309,14 +374,12 @@ gftp_end_transfer (gftp_request * request)
     {
       close (request->cachefd);
       request->cachefd = -1;
+      gftp_finish_cache_entry (request, ret >= 0);
     }
+  else
+    gftp_finish_cache_entry (request, 0);
 
-  if (request->last_dir_entry)
-    {
-      g_free (request->last_dir_entry);
-      request->last_dir_entry = NULL;
-      request->last_dir_entry_len = 0;
-    }
+  gftp_release_cache_entry (request);
 
   return (ret);
 }
@@ -420,12 +483,23 @@ gftp_get_next_file (gftp_request * request, const char *filespec,
   if (request->get_next_file == NULL)
     return (GFTP_EFATAL);
 
-  if (request->cached && request->cachefd > 0)
-    fd = request->cachefd;
-  else
-    fd = request->datafd;
-
   memset (fle, 0, sizeof (*fle));
+
+  /* The cache holds the files as they are returned below */
+  if (request->cached && request->cachemap != NULL)
+    {
+      do
+        {
+          gftp_file_destroy (fle, 0);
+          ret = gftp_read_cache_file (request, fle);
+        }
+      while (ret > 0 && !gftp_match_filespec (request, fle->file, filespec));
+
+      return (ret);
+    }
+
+  fd = request->datafd;
+
   do
     {
       gftp_file_destroy (fle, 0);
@@ -467,17 +541,14 @@ gftp_get_next_file (gftp_request * request, const char *filespec,
             }
         }
 
-      if (ret >= 0 && !request->cached && request->cachefd > 0 && 
-          request->last_dir_entry != NULL)
+      if (ret > 0 && !request->cached && request->cachefd > 0 && 
+          fle->file != NULL)
         {
-          if (gftp_fd_write (request, request->last_dir_entry,
-                          request->last_dir_entry_len, request->cachefd) < 0)
+          if (gftp_write_cache_file (request, fle) < 0)
             {
-              request->logging_function (gftp_logging_error, request,
-                                        _("Error: Cannot write to cache: %s\n"),
-                                        g_strerror (errno));
               close (request->cachefd);
               request->cachefd = -1;
+              gftp_finish_cache_entry (request, 0);
             }
         }
     } while (ret > 0 && !gftp_match_filespec (request, fle->file, filespec));
@@ -589,6 +660,7 @@ gftp_parse_bookmark (gftp_request * request, gftp_request * local_request,
                            &request->num_local_options_vars,
                            tempentry->local_options_vars,
                            tempentry->num_local_options_vars);
+  request->options.serial = 0; /* Look the bookmark's options up again */
 
   if ((init_ret = gftp_protocols[i].init (request)) < 0)
     {
@@ -1436,6 +1508,12 @@ gftp_swap_socks (gftp_request * dest, gftp_request * source)
   g_return_if_fail (source != NULL);
   g_return_if_fail (dest->protonum == source->protonum);
 
+#ifdef USE_SSL
+  /* An SSL session can only have one owner, so a connection that stays
+     with the source can't be shared */
+  g_return_if_fail (!source->always_connected || source->ssl == NULL);
+#endif
+
   dest->datafd = source->datafd;
   dest->cached = 0;
 
@@ -1443,6 +1521,11 @@ gftp_swap_socks (gftp_request * dest, gftp_request * source)
     {
       source->datafd = -1;
       source->cached = 1;
+#ifdef USE_SSL
+      dest->ssl = source->ssl;
+      source->ssl = NULL;
+      gftp_ssl_set_owner (dest);
+#endif
     }
 
   if (dest->swap_socks != NULL)
@@ -1450,57 +1533,108 @@ gftp_swap_socks (gftp_request * dest, gftp_request * source)
 }
 
 
+/* The statistics of a transfer are updated for every block that is
+   transferred and read by the UI at the same time. They are guarded by a
+   sequence counter instead of a mutex: writers make it odd while they
+   change the statistics, readers copy them and try again if the counter
+   changed in the meantime. Readers never hold up the transfer. */
+
+void
+gftp_transfer_stats_begin (gftp_transfer * tdata)
+{
+  gint seq;
+
+  /* Several threads may update one transfer (see transfer_segments), they
+     take turns */
+  while (1)
+    {
+      seq = g_atomic_int_get (&tdata->stat_seq);
+      if (!(seq & 1) &&
+          g_atomic_int_compare_and_exchange (&tdata->stat_seq, seq, seq + 1))
+        break;
+
+      g_thread_yield ();
+    }
+}
+
+
+void
+gftp_transfer_stats_end (gftp_transfer * tdata)
+{
+  g_atomic_int_inc (&tdata->stat_seq);
+}
+
+
+void
+gftp_get_transfer_stats (gftp_transfer * tdata, gftp_transfer_stats * stats)
+{
+  gint seq;
+
+  do
+    {
+      while ((seq = g_atomic_int_get (&tdata->stat_seq)) & 1)
+        g_thread_yield ();
+
+      stats->curtrans = tdata->curtrans;
+      stats->tot_file_trans = tdata->tot_file_trans;
+      stats->curresumed = tdata->curresumed;
+      stats->trans_bytes = tdata->trans_bytes;
+      stats->total_bytes = tdata->total_bytes;
+      stats->resumed_bytes = tdata->resumed_bytes;
+      stats->kbs = tdata->kbs;
+      stats->blksize = tdata->blksize;
+      stats->lasttime = tdata->lasttime;
+    }
+  while (g_atomic_int_get (&tdata->stat_seq) != seq);
+}
+
+
 void
 gftp_calc_kbs (gftp_transfer * tdata, ssize_t num_read)
 {
   DEBUG_PRINT_FUNC
-  /* Needed for systems that size(float) < size(void *) */
-  union { intptr_t i; float f; } maxkbs;
-  unsigned long waitusecs;
-  double start_difftime;
-  struct timeval tv;
-  int waited;
+  gint64 now, elapsed, waitusecs;
+  off_t trans_bytes;
+  double kbs;
+  float maxkbs;
 
-  gftp_lookup_request_option (tdata->fromreq, "maxkbs", &maxkbs.f);
+  now = g_get_monotonic_time ();
+  maxkbs = gftp_get_request_options (tdata->fromreq)->maxkbs;
 
-  g_mutex_lock (&tdata->statmutex);
-
-  gettimeofday (&tv, NULL);
+  gftp_transfer_stats_begin (tdata);
 
   tdata->trans_bytes += num_read;
   tdata->curtrans += num_read;
   tdata->stalled = 0;
 
-  start_difftime = (tv.tv_sec - tdata->starttime.tv_sec) + ((double) (tv.tv_usec - tdata->starttime.tv_usec) / 1000000.0);
-
-  if (start_difftime <= 0)
+  elapsed = now - tdata->starttime;
+  if (elapsed <= 0)
     tdata->kbs = tdata->trans_bytes / 1024.0;
   else
-    tdata->kbs = tdata->trans_bytes / 1024.0 / start_difftime;
+    tdata->kbs = tdata->trans_bytes / 1024.0 / ((double) elapsed / G_USEC_PER_SEC);
 
-  waited = 0;
-  if (maxkbs.f > 0 && tdata->kbs > maxkbs.f)
+  tdata->lasttime = now;
+
+  kbs = tdata->kbs;
+  trans_bytes = tdata->trans_bytes;
+
+  gftp_transfer_stats_end (tdata);
+
+  if (maxkbs > 0 && kbs > maxkbs)
     {
-      waitusecs = num_read / 1024.0 / maxkbs.f * 1000000.0 - start_difftime;
+      /* Wait until the time that transferring trans_bytes should take at
+         maxkbs has passed */
+      waitusecs = (gint64) (trans_bytes / 1024.0 / maxkbs * G_USEC_PER_SEC) - elapsed;
 
       if (waitusecs > 0)
         {
-          g_mutex_unlock (&tdata->statmutex);
+          g_usleep (waitusecs);
 
-          waited = 1;
-          usleep (waitusecs);
-
-          g_mutex_lock (&tdata->statmutex);
+          gftp_transfer_stats_begin (tdata);
+          tdata->lasttime = g_get_monotonic_time ();
+          gftp_transfer_stats_end (tdata);
         }
-
     }
-
-  if (waited)
-    gettimeofday (&tdata->lasttime, NULL);
-  else
-    memcpy (&tdata->lasttime, &tv, sizeof (tdata->lasttime));
-
-  g_mutex_unlock (&tdata->statmutex);
 }
 
 
@@ -1588,6 +1722,7 @@ gftp_get_transfer_status (gftp_transfer * tdata, ssize_t num_read)
           (ret2 = gftp_connect (tdata->toreq)) == 0)
         {
           g_mutex_lock (&tdata->structmutex);
+          gftp_transfer_stats_begin (tdata);
 
           tdata->resumed_bytes = tdata->resumed_bytes + tdata->trans_bytes - tdata->curresumed - tdata->curtrans;
           tdata->trans_bytes = 0;
@@ -1603,6 +1738,13 @@ gftp_get_transfer_status (gftp_transfer * tdata, ssize_t num_read)
               tdata->fromreq->cancel = 0;
               tdata->toreq->cancel = 0;
             }
+          else if (tempfle->segments != NULL)
+            {
+              /* The segments remember how far each range got, only the
+                 unfinished ones are fetched again */
+              tdata->curresumed = 0;
+              tdata->current_file_number--;
+            }
           else
             {
               tempfle->transfer_action = GFTP_TRANS_ACTION_RESUME;
@@ -1615,8 +1757,9 @@ gftp_get_transfer_status (gftp_transfer * tdata, ssize_t num_read)
                                                continue in the loop */
             }
 
-          gettimeofday (&tdata->starttime, NULL);
+          tdata->starttime = g_get_monotonic_time ();
 
+          gftp_transfer_stats_end (tdata);
           g_mutex_unlock (&tdata->structmutex);
 
           return (GFTP_ERETRYABLE);
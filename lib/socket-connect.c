@@ -90,17 +90,144 @@ void w_sockaddr_set_port (struct sockaddr * saddr, int port)
 
 // ====================================================================
 
+/* The addresses of the hosts that were looked up recently, shared by all
+   requests. Reconnects and the other connections of a transfer don't have
+   to wait for the resolver again */
+
+#define GFTP_DNS_CACHE_TTL 60  /* seconds */
+#define GFTP_DNS_CACHE_MAX 64
+
+typedef struct gftp_dns_entry_tag
+{
+  struct addrinfo * addrs;
+  gint64 expires;
+} gftp_dns_entry;
+
+static GHashTable * gftp_dns_cache = NULL;
+static WGMutex gftp_dns_mutex;
+
+
+/* Copies a getaddrinfo() result. Each entry is a single allocation that
+   holds the address and canonical name too */
+
+static struct addrinfo * copy_addrinfo (struct addrinfo * src)
+{
+  struct addrinfo *head, **tail, *addri;
+  size_t namelen;
+
+  head = NULL;
+  tail = &head;
+  for (; src != NULL; src = src->ai_next)
+  {
+      namelen = src->ai_canonname != NULL ? strlen (src->ai_canonname) + 1 : 0;
+      addri = g_malloc0 (sizeof (*addri) + src->ai_addrlen + namelen);
+      *addri = *src;
+      addri->ai_next = NULL;
+      addri->ai_addr = (struct sockaddr *) (addri + 1);
+      memcpy (addri->ai_addr, src->ai_addr, src->ai_addrlen);
+      if (namelen > 0) {
+          addri->ai_canonname = (char *) addri->ai_addr + src->ai_addrlen;
+          memcpy (addri->ai_canonname, src->ai_canonname, namelen);
+      }
+
+      *tail = addri;
+      tail = &addri->ai_next;
+  }
+
+  return (head);
+}
+
+
+static void free_addrinfo (struct addrinfo * addri)
+{
+  struct addrinfo * next;
+
+  for (; addri != NULL; addri = next)
+  {
+      next = addri->ai_next;
+      g_free (addri);
+  }
+}
+
+
+static void dns_entry_free (gpointer data)
+{
+  gftp_dns_entry * entry = data;
+
+  free_addrinfo (entry->addrs);
+  g_free (entry);
+}
+
+
+static gboolean dns_entry_expired (gpointer key, gpointer value, gpointer now)
+{
+  return (((gftp_dns_entry *) value)->expires <= *(gint64 *) now);
+}
+
+
+/* Returns a copy of the addresses for key, or NULL when they are not
+   cached or expired */
+
+static struct addrinfo * dns_cache_lookup (const char * key, gint64 now)
+{
+  gftp_dns_entry * entry;
+  struct addrinfo * addrs;
+
+  g_mutex_lock (&gftp_dns_mutex);
+  entry = gftp_dns_cache != NULL ? g_hash_table_lookup (gftp_dns_cache, key) : NULL;
+  addrs = entry != NULL && entry->expires > now ? copy_addrinfo (entry->addrs) : NULL;
+  g_mutex_unlock (&gftp_dns_mutex);
+
+  return (addrs);
+}
+
+
+static void dns_cache_store (const char * key, struct addrinfo * addrs, gint64 now)
+{
+  gftp_dns_entry * entry;
+
+  entry = g_malloc0 (sizeof (*entry));
+  entry->addrs = copy_addrinfo (addrs);
+  entry->expires = now + (gint64) GFTP_DNS_CACHE_TTL * G_USEC_PER_SEC;
+
+  g_mutex_lock (&gftp_dns_mutex);
+  if (gftp_dns_cache == NULL) {
+      gftp_dns_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, dns_entry_free);
+  }
+  if (g_hash_table_size (gftp_dns_cache) >= GFTP_DNS_CACHE_MAX) {
+      g_hash_table_foreach_remove (gftp_dns_cache, dns_entry_expired, &now);
+      /* Nothing expired yet, start over instead of growing without bound */
+      if (g_hash_table_size (gftp_dns_cache) >= GFTP_DNS_CACHE_MAX)
+          g_hash_table_remove_all (gftp_dns_cache);
+  }
+  g_hash_table_replace (gftp_dns_cache, g_strdup (key), entry);
+  g_mutex_unlock (&gftp_dns_mutex);
+}
+
+
+static void dns_cache_forget (const char * key)
+{
+  g_mutex_lock (&gftp_dns_mutex);
+  if (gftp_dns_cache != NULL)
+      g_hash_table_remove (gftp_dns_cache, key);
+  g_mutex_unlock (&gftp_dns_mutex);
+}
+
+
 static struct addrinfo * lookup_host (gftp_request *request,
                                       char *service,
                                       char *host,
-                                      unsigned int port)
+                                      unsigned int port,
+                                      char **cache_key)
 {
   // this is where everything about the connection is specified
   // the resulting addrinfo will contain info according to the params specified here
   DEBUG_PRINT_FUNC
-  struct addrinfo hints, *hostp;
+  struct addrinfo hints, *hostp, *addrs;
   char * ip_version;
   char serv[8];
+  gint64 now;
   int ret;
 
   gftp_lookup_request_option (request, "ip_version", &ip_version);
@@ -130,6 +257,15 @@ static struct addrinfo * lookup_host (gftp_request *request,
   } else {
       snprintf (serv, sizeof (serv), "%d", port);
   }
+
+  *cache_key = g_strdup_printf ("%s/%s/%d/%d", host, serv, hints.ai_family,
+                                hints.ai_socktype);
+  now = g_get_monotonic_time ();
+
+  if ((addrs = dns_cache_lookup (*cache_key, now)) != NULL) {
+      return (addrs);
+  }
+
   request->logging_function (gftp_logging_misc, request, _("Looking up %s\n"), host);
 
   ret = getaddrinfo (host, serv, &hints, &hostp);
@@ -139,18 +275,43 @@ static struct addrinfo * lookup_host (gftp_request *request,
       return (NULL);
   }
 
-  return (hostp);
+  addrs = copy_addrinfo (hostp);
+  freeaddrinfo (hostp);
+
+  dns_cache_store (*cache_key, addrs, now);
+
+  return (addrs);
 }
 
 
-static int connection_new (gftp_request * request, struct addrinfo * addri)
+static void log_connect_attempt (gftp_request * request, struct addrinfo * addri)
+{
+  char ipstr[128], * hostname;
+  int port;
+
+  port = w_sockaddr_get_port (addri->ai_addr);
+  w_sockaddr_get_ip_str (addri->ai_addr, ipstr, sizeof(ipstr));
+  hostname = addri->ai_canonname;
+  if (!hostname || strcmp(hostname, ipstr) == 0) {
+      request->logging_function (gftp_logging_misc, request,
+                                 _("Trying %s:%d\n"), ipstr, port);
+  } else {
+      request->logging_function (gftp_logging_misc, request,
+                                 _("Trying %s:%d (%s)\n"), hostname, port, ipstr);
+  }
+}
+
+
+/* Starts a non-blocking connection. Returns the socket, with *connected set
+   if the connection is already up, or -1 if it failed right away */
+
+static int connection_start (gftp_request * request, struct addrinfo * addri,
+                             int * connected)
 {
   DEBUG_PRINT_FUNC
   int sock, ret;
-  struct timeval timeout;
-  timeout.tv_sec = 30; /* connection timeout in seconds */
-  timeout.tv_usec = 0;
 
+  *connected = 0;
   sock = socket (addri->ai_family, addri->ai_socktype, 0);
   if (sock < 0)
   {
@@ -161,20 +322,31 @@ static int connection_new (gftp_request * request, struct addrinfo * addri)
 
   if (fcntl (sock, F_SETFD, 1) == -1)
   {
+      ret = errno;
       close (sock);
       request->logging_function (gftp_logging_error, request,
-                                 _("Error: Cannot set close on exec flag: %s\n"), g_strerror (errno));
+                                 _("Error: Cannot set close on exec flag: %s\n"), g_strerror (ret));
+      errno = ret;
       return -1;
   }
 
-  setsockopt (sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  if (gftp_fd_set_sockblocking (request, sock, 1) < 0)
+  {
+      close (sock);
+      return -1;
+  }
 
   ret = connect (sock, addri->ai_addr, addri->ai_addrlen);
-  if (ret == -1)
+  if (ret == 0) {
+      *connected = 1;
+  }
+  else if (errno != EINPROGRESS)
   {
+      ret = errno;
       close (sock);
       request->logging_function (gftp_logging_error, request,
-                                 _("Cannot create a connection: %s\n"), g_strerror (errno));
+                                 _("Cannot create a connection: %s\n"), g_strerror (ret));
+      errno = ret;
       return -1;
   }
 
@@ -182,6 +354,166 @@ static int connection_new (gftp_request * request, struct addrinfo * addri)
 }
 
 
+/* Connects to one of the addresses the way RFC 8305 ("Happy Eyeballs")
+   suggests. The address families take turns, starting with the one the
+   resolver put first. A new connection is started every
+   GFTP_CONNECT_ATTEMPT_DELAY msecs while the earlier ones are still
+   pending, and the first one to succeed is kept. A dead IPv6 route then
+   only costs the delay instead of a whole connect timeout.
+   Returns the socket and sets *winner, or returns -1 with errno set */
+
+#define GFTP_CONNECT_ATTEMPT_DELAY 250  /* msecs */
+#define GFTP_CONNECT_MAX_ATTEMPTS  16
+
+static int connect_addresses (gftp_request * request, struct addrinfo * addrs,
+                              int log_attempts, struct addrinfo ** winner)
+{
+  DEBUG_PRINT_FUNC
+  struct addrinfo *order[GFTP_CONNECT_MAX_ATTEMPTS], *pending_ai[GFTP_CONNECT_MAX_ATTEMPTS];
+  struct pollfd pfds[GFTP_CONNECT_MAX_ATTEMPTS];
+  struct addrinfo *addri, *other;
+  int num, started, pending, sock, connected, last_errno, ret, i;
+  intptr_t network_timeout;
+  gint64 now, deadline, next_start, wait;
+  socklen_t len;
+
+  /* Interleave the address families */
+  num = 0;
+  addri = addrs;
+  other = NULL;
+  for (other = addrs; other != NULL && other->ai_family == addrs->ai_family;
+       other = other->ai_next);
+  while ((addri != NULL || other != NULL) && num < GFTP_CONNECT_MAX_ATTEMPTS)
+  {
+      if (addri != NULL)
+      {
+          order[num++] = addri;
+          for (addri = addri->ai_next;
+               addri != NULL && addri->ai_family != addrs->ai_family;
+               addri = addri->ai_next);
+      }
+      if (other != NULL && num < GFTP_CONNECT_MAX_ATTEMPTS)
+      {
+          order[num++] = other;
+          for (other = other->ai_next;
+               other != NULL && other->ai_family == addrs->ai_family;
+               other = other->ai_next);
+      }
+  }
+
+  gftp_lookup_request_option (request, "network_timeout", &network_timeout);
+  now = g_get_monotonic_time ();
+  deadline = now + (gint64) (network_timeout > 0 ? network_timeout : 30) * G_USEC_PER_SEC;
+  next_start = now;
+  started = pending = 0;
+  last_errno = ETIMEDOUT;
+  sock = -1;
+
+  while (sock == -1)
+  {
+      if (request->cancel)
+      {
+          last_errno = EINTR;
+          break;
+      }
+
+      now = g_get_monotonic_time ();
+      if (started < num && (now >= next_start || pending == 0))
+      {
+          if (log_attempts) {
+              log_connect_attempt (request, order[started]);
+          }
+
+          ret = connection_start (request, order[started], &connected);
+          if (ret < 0) {
+              last_errno = errno;
+          } else if (connected) {
+              sock = ret;
+              *winner = order[started];
+          } else {
+              pfds[pending].fd = ret;
+              pfds[pending].events = POLLOUT;
+              pfds[pending].revents = 0;
+              pending_ai[pending++] = order[started];
+          }
+
+          started++;
+          next_start = now + GFTP_CONNECT_ATTEMPT_DELAY * 1000;
+          continue;
+      }
+
+      if (pending == 0) {
+          break; /* All of them failed */
+      }
+
+      if (now >= deadline)
+      {
+          request->logging_function (gftp_logging_error, request,
+                                     _("Connection to %s timed out\n"),
+                                     request->hostname);
+          last_errno = ETIMEDOUT;
+          break;
+      }
+
+      /* Wake up for the next attempt, and now and then to check for
+         cancellation */
+      wait = deadline - now;
+      if (started < num && next_start - now < wait) {
+          wait = next_start - now;
+      }
+      if (wait > GFTP_CONNECT_ATTEMPT_DELAY * 1000) {
+          wait = GFTP_CONNECT_ATTEMPT_DELAY * 1000;
+      }
+
+      ret = poll (pfds, pending, (int) (wait / 1000) + 1);
+      if (ret < 0 && errno != EINTR)
+      {
+          last_errno = errno;
+          break;
+      }
+
+      for (i = 0; ret > 0 && i < pending; i++)
+      {
+          if (pfds[i].revents == 0) {
+              continue;
+          }
+
+          len = sizeof (ret);
+          if (getsockopt (pfds[i].fd, SOL_SOCKET, SO_ERROR, &ret, &len) < 0) {
+              ret = errno;
+          }
+
+          if (ret == 0)
+          {
+              sock = pfds[i].fd;
+              *winner = pending_ai[i];
+              pfds[i] = pfds[--pending];
+              pending_ai[i] = pending_ai[pending];
+              break;
+          }
+
+          request->logging_function (gftp_logging_error, request,
+                                     _("Cannot create a connection: %s\n"), g_strerror (ret));
+          last_errno = ret;
+          close (pfds[i].fd);
+          pfds[i] = pfds[--pending];
+          pending_ai[i] = pending_ai[pending];
+          i--;
+          ret = 1;
+      }
+  }
+
+  for (i = 0; i < pending; i++) {
+      close (pfds[i].fd);
+  }
+
+  if (sock == -1) {
+      errno = last_errno;
+  }
+  return sock;
+}
+
+
 // ========================================================================
 
 int gftp_connect_server (gftp_request * request,
@@ -194,11 +526,9 @@ int gftp_connect_server (gftp_request * request,
   // - see remote_addr, remote_addr_len, ai_family, ai_socktype
   DEBUG_PRINT_FUNC
   struct addrinfo *hostp, *current_hostp;
-  struct sockaddr * saddr;
-  char ipstr[128], * hostname;
+  char ipstr[128], * hostname, * cache_key;
   char * connect_host;
   unsigned int connect_port;
-  int last_errno = 0;
   unsigned int port;
   int sock = -1;
   intptr_t use_proxy = 0;
@@ -222,47 +552,24 @@ int gftp_connect_server (gftp_request * request,
       connect_port = request->port;
   }
 
-  hostp = lookup_host (request, service, connect_host, connect_port);
+  cache_key = NULL;
+  hostp = lookup_host (request, service, connect_host, connect_port, &cache_key);
 
   if (hostp == NULL) {
+      g_free (cache_key);
       return (GFTP_EFATAL);
   }
 
-  for (current_hostp = hostp;
-       current_hostp != NULL;
-       current_hostp = current_hostp->ai_next)
-  {
-      saddr = current_hostp->ai_addr;
-      port = w_sockaddr_get_port (saddr);
-      if (!request->use_proxy) {
-          request->port = port;
-      }
-      hostname = current_hostp[0].ai_canonname;
-      w_sockaddr_get_ip_str (saddr, ipstr, sizeof(ipstr));
-      if (hostname && (strcmp(hostname, ipstr) == 0)) {
-         hostname = ipstr;
-      }
-      if (!hostname || (hostname == ipstr)) {
-         hostname = hostname ? hostname : ipstr;
-         request->logging_function (gftp_logging_misc, request,
-                                    _("Trying %s:%d\n"), hostname, port);
-      } else {
-         request->logging_function (gftp_logging_misc, request,
-                                    _("Trying %s:%d (%s)\n"), hostname, port, ipstr);
-      }
-
-      sock = connection_new (request, current_hostp);
-      if (sock < 0) {
-          last_errno = errno;
-          continue;
-      }
-      break;
-  }
+  current_hostp = NULL;
+  sock = connect_addresses (request, hostp, 1, &current_hostp);
 
-  if (current_hostp == NULL || sock == -1) // was unable to connect to any host
+  if (sock == -1) // was unable to connect to any host
   {
-      freeaddrinfo (hostp);
-      switch (last_errno)
+      /* Look the host up again next time, its addresses may have changed */
+      dns_cache_forget (cache_key);
+      g_free (cache_key);
+      free_addrinfo (hostp);
+      switch (errno)
       {
          case EINVAL:       /* Invalid argument */
          case EHOSTUNREACH: /* No route to host */
@@ -272,7 +579,18 @@ int gftp_connect_server (gftp_request * request,
             return (GFTP_ERETRYABLE);
       }
   }
+  g_free (cache_key);
 
+  port = w_sockaddr_get_port (current_hostp->ai_addr);
+  if (!request->use_proxy) {
+      request->port = port;
+  }
+  w_sockaddr_get_ip_str (current_hostp->ai_addr, ipstr, sizeof(ipstr));
+  hostname = hostp->ai_canonname ? hostp->ai_canonname : ipstr;
+
+  if (request->remote_addr) {
+      free (request->remote_addr);
+  }
   request->ai_family       = current_hostp->ai_family;
   request->ai_socktype     = current_hostp->ai_socktype;
   request->remote_addr_len = current_hostp->ai_addrlen;
@@ -282,14 +600,7 @@ int gftp_connect_server (gftp_request * request,
 
   request->logging_function (gftp_logging_misc, request,
                              _("Connected to %s:%d\n"), hostname, port);
-  freeaddrinfo (hostp);
-
-  // everything has been set
-  if (gftp_fd_set_sockblocking (request, sock, 1) < 0)
-  {
-      close (sock);
-      return (GFTP_ERETRYABLE);
-  }
+  free_addrinfo (hostp);
 
   request->datafd = sock; /*** this ***/
 
@@ -309,19 +620,15 @@ int gftp_data_connection_new (gftp_request * request)
   // - The calling function must modify request->remote_addr to set the port
   //   and change the IP if needed
   DEBUG_PRINT_FUNC
-  int sock = -1;
+  struct addrinfo addri, *winner;
 
-  struct addrinfo * addri = calloc (1, sizeof(struct addrinfo));
-  addri->ai_family   = request->ai_family;
-  addri->ai_socktype = request->ai_socktype;
-  //addri->ai_protocol = request->ai_protocol;
-  addri->ai_addr     = request->remote_addr;
-  addri->ai_addrlen  = request->remote_addr_len;
+  memset (&addri, 0, sizeof (addri));
+  addri.ai_family   = request->ai_family;
+  addri.ai_socktype = request->ai_socktype;
+  addri.ai_addr     = request->remote_addr;
+  addri.ai_addrlen  = request->remote_addr_len;
 
-  sock = connection_new (request, addri);
-  free (addri);
-
-  return sock;
+  return (connect_addresses (request, &addri, 0, &winner));
 }
 
 
@@ -31,7 +31,7 @@ gftp_get_line (gftp_request * request, gftp_getline_buffer ** rbuf,
   ssize_t (*read_function) (gftp_request * request, void *ptr, size_t size,
                             int fd);
   char *pos, *nextpos;
-  size_t rlen, nslen;
+  size_t rlen, nslen, linelen;
   int end_of_buffer;
   ssize_t ret;
   gftp_getline_buffer * rrbuf; // = *rbuf (avoid too many (*rbuf)->)
@@ -98,8 +98,12 @@ gftp_get_line (gftp_request * request, gftp_getline_buffer ** rbuf,
               (rrbuf->buffer)[nslen] = '\0';
           }
 
-          strncpy (str, rrbuf->curpos, len);
-          str[len - 1] = '\0';
+          /* Only copy the line, strncpy() would pad all of str */
+          linelen = strlen (rrbuf->curpos);
+          if (linelen >= len)
+            linelen = len - 1;
+          memcpy (str, rrbuf->curpos, linelen);
+          str[linelen] = '\0';
           rrbuf->cur_bufsize -= nslen;
 
           if (nextpos != NULL)
@@ -158,6 +162,24 @@ gftp_get_line (gftp_request * request, gftp_getline_buffer ** rbuf,
 }
 
 
+/* gftp_get_line() reads as much as the line that is asked for at a time.
+   Readers of long streams of short lines, such as directory listings, can
+   set up a bigger buffer with this first */
+
+gftp_getline_buffer *
+gftp_new_getline_buffer (size_t bufsize)
+{
+  gftp_getline_buffer * rbuf;
+
+  rbuf = g_malloc0 (sizeof (*rbuf));
+  rbuf->max_bufsize = bufsize;
+  rbuf->buffer = g_malloc0 ((gsize) (bufsize + 1));
+  rbuf->curpos = rbuf->buffer;
+
+  return (rbuf);
+}
+
+
 void gftp_free_getline_buffer (gftp_getline_buffer ** rbuf)
 {
   DEBUG_PRINT_FUNC
@@ -171,30 +193,32 @@ void gftp_free_getline_buffer (gftp_getline_buffer ** rbuf)
 }
 
 
-ssize_t 
-gftp_fd_read (gftp_request * request, void *ptr, size_t size, int fd)
+/* Waits until fd is readable (POLLIN) or writable (POLLOUT), for at most
+   network_timeout seconds. The network descriptors are non-blocking, so
+   the functions below try the read or write first and only come here when
+   the kernel has nothing for them. Unlike select(), poll() works with
+   descriptors past FD_SETSIZE */
+
+int
+gftp_fd_wait (gftp_request * request, int fd, short events)
 {
   intptr_t network_timeout;
-  struct timeval tv;
-  fd_set fset;
-  ssize_t ret;
-  int s_ret;
-
-  g_return_val_if_fail (fd >= 0, GFTP_EFATAL);
+  struct pollfd pfd;
+  int ret;
 
-  gftp_lookup_request_option (request, "network_timeout", &network_timeout);  
+  if (request != NULL)
+    network_timeout = gftp_get_request_options (request)->network_timeout;
+  else
+    gftp_lookup_global_option ("network_timeout", &network_timeout);
 
-  errno = 0;
-  ret = 0;
-  FD_ZERO (&fset);
+  pfd.fd = fd;
+  pfd.events = events;
 
   do
   {
-      FD_SET (fd, &fset);
-      tv.tv_sec = network_timeout;
-      tv.tv_usec = 0;
-      s_ret = select (fd + 1, &fset, NULL, NULL, &tv);
-      if (s_ret == -1 && (errno == EINTR || errno == EAGAIN))
+      pfd.revents = 0;
+      ret = poll (&pfd, 1, network_timeout > 0 ? network_timeout * 1000 : -1);
+      if (ret == -1 && errno == EINTR)
       {
           if (request != NULL && request->cancel)
           {
@@ -204,7 +228,7 @@ gftp_fd_read (gftp_request * request, void *ptr, size_t size, int fd)
 
           continue;
       }
-      else if (s_ret <= 0)
+      else if (ret <= 0)
       {
           if (request != NULL)
           {
@@ -217,9 +241,60 @@ gftp_fd_read (gftp_request * request, void *ptr, size_t size, int fd)
           return (GFTP_ERETRYABLE);
       }
 
+      break;
+  }
+  while (1);
+
+  return (0);
+}
+
+
+/* Stores the size of the send buffer of the socket fd and the number of
+   bytes that are still queued in it. Returns -1 if fd isn't a socket */
+
+int
+gftp_fd_get_send_queue (int fd, int *sndbuf, int *queued)
+{
+  socklen_t len;
+
+  len = sizeof (*sndbuf);
+  if (getsockopt (fd, SOL_SOCKET, SO_SNDBUF, sndbuf, &len) < 0)
+    return (-1);
+
+#ifdef TIOCOUTQ
+  if (ioctl (fd, TIOCOUTQ, queued) < 0)
+    return (-1);
+#else
+  *queued = 0;
+#endif
+
+  return (0);
+}
+
+
+ssize_t 
+gftp_fd_read (gftp_request * request, void *ptr, size_t size, int fd)
+{
+  ssize_t ret;
+  int w_ret;
+
+  g_return_val_if_fail (fd >= 0, GFTP_EFATAL);
+
+  errno = 0;
+  ret = 0;
+
+  do
+  {
       if ((ret = read (fd, ptr, size)) < 0)
       {
-          if (errno == EINTR || errno == EAGAIN)
+          if (errno == EAGAIN)
+          {
+              if ((w_ret = gftp_fd_wait (request, fd, POLLIN)) < 0)
+                  return (w_ret);
+
+              continue;
+          }
+          else if (errno == EINTR)
           {
               if (request != NULL && request->cancel)
               {
@@ -252,53 +327,91 @@ gftp_fd_read (gftp_request * request, void *ptr, size_t size, int fd)
 ssize_t 
 gftp_fd_write (gftp_request * request, const char *ptr, size_t size, int fd)
 {
-  intptr_t network_timeout;
-  struct timeval tv;
   int ret, s_ret;
   ssize_t w_ret;
-  fd_set fset;
 
   g_return_val_if_fail (fd >= 0, GFTP_EFATAL);
 
-  gftp_lookup_request_option (request, "network_timeout", &network_timeout);  
-
   errno = 0;
   ret = 0;
-  FD_ZERO (&fset);
 
   do
   {
-      FD_SET (fd, &fset);
-      tv.tv_sec = network_timeout;
-      tv.tv_usec = 0;
-      s_ret = select (fd + 1, NULL, &fset, NULL, &tv);
-      if (s_ret == -1 && (errno == EINTR || errno == EAGAIN))
+      w_ret = write (fd, ptr, size);
+      if (w_ret < 0)
       {
-          if (request != NULL && request->cancel)
+          if (errno == EAGAIN)
           {
-              gftp_disconnect (request);
-              return (GFTP_ERETRYABLE);
+              if ((s_ret = gftp_fd_wait (request, fd, POLLOUT)) < 0)
+                  return (s_ret);
+
+              continue;
           }
+          else if (errno == EINTR)
+          {
+              if (request != NULL && request->cancel)
+              {
+                  gftp_disconnect (request);
+                  return (GFTP_ERETRYABLE);
+              }
 
-          continue;
-      }
-      else if (s_ret <= 0)
-      {
+              continue;
+           }
+ 
           if (request != NULL)
           {
               request->logging_function (gftp_logging_error, request,
-                                         _("Connection to %s timed out\n"),
-                                         request->hostname);
+                                    _("Error: Could not write to socket: %s\n"),
+                                    g_strerror (errno));
               gftp_disconnect (request);
           }
 
           return (GFTP_ERETRYABLE);
       }
 
-      w_ret = write (fd, ptr, size);
+      ptr += w_ret;
+      size -= w_ret;
+      ret += w_ret;
+  }
+  while (size > 0);
+
+  return (ret);
+}
+
+
+ssize_t 
+gftp_fd_writev (gftp_request * request, struct iovec *iov, int iovcnt, int fd)
+{
+  int ret, s_ret;
+  ssize_t w_ret;
+
+  g_return_val_if_fail (fd >= 0, GFTP_EFATAL);
+
+  errno = 0;
+  ret = 0;
+
+  /* Same as gftp_fd_write(), but the data is gathered from several buffers
+     so that the caller doesn't have to copy them into one. Note that iov is
+     modified as the data is written */
+  while (iovcnt > 0 && iov->iov_len == 0)
+  {
+      iov++;
+      iovcnt--;
+  }
+
+  while (iovcnt > 0)
+  {
+      w_ret = writev (fd, iov, iovcnt);
       if (w_ret < 0)
       {
-          if (errno == EINTR || errno == EAGAIN)
+          if (errno == EAGAIN)
+          {
+              if ((s_ret = gftp_fd_wait (request, fd, POLLOUT)) < 0)
+                  return (s_ret);
+
+              continue;
+          }
+          else if (errno == EINTR)
           {
               if (request != NULL && request->cancel)
               {
@@ -320,16 +433,155 @@ gftp_fd_write (gftp_request * request, const char *ptr, size_t size, int fd)
           return (GFTP_ERETRYABLE);
       }
 
-      ptr += w_ret;
-      size -= w_ret;
       ret += w_ret;
+      while (iovcnt > 0 && (size_t) w_ret >= iov->iov_len)
+      {
+          w_ret -= iov->iov_len;
+          iov++;
+          iovcnt--;
+      }
+
+      if (iovcnt > 0)
+      {
+          iov->iov_base = (char *) iov->iov_base + w_ret;
+          iov->iov_len -= w_ret;
+      }
   }
-  while (size > 0);
 
   return (ret);
 }
 
 
+#ifdef HAVE_SENDFILE_SPLICE
+ssize_t 
+gftp_fd_sendfile (gftp_request * request, int infd, int outfd, size_t size)
+{
+  ssize_t w_ret;
+  int s_ret;
+
+  g_return_val_if_fail (infd >= 0, GFTP_EFATAL);
+  g_return_val_if_fail (outfd >= 0, GFTP_EFATAL);
+
+  errno = 0;
+
+  /* Sends up to size bytes from the current position of the file infd to
+     the socket outfd without copying them through user space */
+  do
+  {
+      if ((w_ret = sendfile (outfd, infd, NULL, size)) < 0)
+      {
+          if (errno == EAGAIN)
+          {
+              if ((s_ret = gftp_fd_wait (request, outfd, POLLOUT)) < 0)
+                  return (s_ret);
+
+              continue;
+          }
+          else if (errno == EINTR)
+          {
+              if (request != NULL && request->cancel)
+              {
+                  gftp_disconnect (request);
+                  return (GFTP_ERETRYABLE);
+              }
+
+              continue;
+          }
+ 
+          if (request != NULL)
+          {
+              request->logging_function (gftp_logging_error, request,
+                                    _("Error: Could not write to socket: %s\n"),
+                                    g_strerror (errno));
+              gftp_disconnect (request);
+          }
+
+          return (GFTP_ERETRYABLE);
+      }
+
+      break;
+  }
+  while (1);
+
+  return (w_ret);
+}
+
+
+ssize_t 
+gftp_fd_splice (gftp_request * request, int infd, int outfd, int *pipefd,
+                size_t size)
+{
+  ssize_t ret, w_ret, moved;
+  int s_ret;
+
+  g_return_val_if_fail (infd >= 0, GFTP_EFATAL);
+  g_return_val_if_fail (outfd >= 0, GFTP_EFATAL);
+
+  errno = 0;
+
+  /* Moves up to size bytes from the socket infd to the file outfd. The data
+     goes through pipefd, so it never has to be copied into user space */
+  do
+  {
+      ret = splice (infd, NULL, pipefd[1], NULL, size,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (ret < 0)
+      {
+          if (errno == EAGAIN)
+          {
+              if ((s_ret = gftp_fd_wait (request, infd, POLLIN)) < 0)
+                  return (s_ret);
+
+              continue;
+          }
+          else if (errno == EINTR)
+          {
+              if (request != NULL && request->cancel)
+              {
+                  gftp_disconnect (request);
+                  return (GFTP_ERETRYABLE);
+              }
+
+              continue;
+          }
+ 
+          if (request != NULL)
+          {
+              request->logging_function (gftp_logging_error, request,
+                                   _("Error: Could not read from socket: %s\n"),
+                                    g_strerror (errno));
+              gftp_disconnect (request);
+          }
+
+          return (GFTP_ERETRYABLE);
+      }
+
+      break;
+  }
+  while (1);
+
+  for (moved = 0; moved < ret; moved += w_ret)
+  {
+      w_ret = splice (pipefd[0], NULL, outfd, NULL, ret - moved,
+                      SPLICE_F_MOVE);
+      if (w_ret < 0 && errno == EINTR)
+          w_ret = 0;
+      else if (w_ret <= 0)
+      {
+          if (request != NULL)
+              request->logging_function (gftp_logging_error, request,
+                                   _("Error: Could not write to local file: %s\n"),
+                                   g_strerror (errno));
+
+          return (GFTP_ERETRYABLE);
+      }
+  }
+
+  return (ret);
+}
+#endif
+
+
 ssize_t 
 gftp_writefmt (gftp_request * request, int fd, const char *fmt, ...)
 {
@@ -390,7 +642,9 @@ int gftp_fd_set_sockblocking (gftp_request * request, int fd, int non_blocking)
   if (fcntl (fd, F_SETFL, flags) < 0)
   {
       request->logging_function (gftp_logging_error, request,
-                                 _("Cannot set socket to non-blocking: %s\n"),
+                                 non_blocking ?
+                                   _("Cannot set socket to non-blocking: %s\n") :
+                                   _("Cannot set socket to blocking: %s\n"),
                                  g_strerror (errno));
       gftp_disconnect (request);
       return (GFTP_ERETRYABLE);
@@ -25,6 +25,19 @@
 
 #define SSH_MAX_HANDLE_SIZE		256
 #define SSH_MAX_STRING_SIZE		34000
+#define SSH_MAX_READ_AHEAD		256
+#define SSH_MAX_WRITES_IN_FLIGHT	256
+
+/* Packet limits used unless the server reports its own through the
+   limits@openssh.com extension. Every server has to accept 34000 byte
+   packets. SSH_MIN_PACKET_SIZE and SSH_MAX_PACKET_SIZE bound what the
+   server may ask for, the minimum leaves room for the packet headers */
+#define SSH_DEFAULT_MAX_PACKET		34000
+#define SSH_DEFAULT_MAX_READ		32768
+#define SSH_DEFAULT_MAX_WRITE		32768
+#define SSH_MIN_PACKET_SIZE		4096
+#define SSH_MAX_PACKET_SIZE		262144
+#define SSH_LIMITS_EXTENSION		"limits@openssh.com"
 
 static gftp_config_vars config_vars[] =
 {
@@ -43,6 +56,15 @@ static gftp_config_vars config_vars[] =
    GFTP_CVARS_FLAGS_SHOW_BOOKMARK,
    N_("Require a username/password for SSH connections"), GFTP_PORT_ALL, NULL},
 
+  {"ssh_read_ahead", N_("SFTP Read-ahead Requests:"), 
+   gftp_option_type_int, GINT_TO_POINTER(16), NULL, 
+   GFTP_CVARS_FLAGS_SHOW_BOOKMARK,
+   N_("The number of read requests kept outstanding while downloading a file. Set this to 1 to disable read-ahead"), GFTP_PORT_ALL, NULL},
+  {"ssh_write_behind", N_("SFTP Write-behind (KB):"), 
+   gftp_option_type_int, GINT_TO_POINTER(256), NULL, 
+   GFTP_CVARS_FLAGS_SHOW_BOOKMARK,
+   N_("The amount of uploaded data that may be waiting for the server to acknowledge it. Set this to 0 to wait for every write"), GFTP_PORT_ALL, NULL},
+
   {NULL, NULL, 0, NULL, NULL, 0, NULL, 0, NULL}
 };
 
@@ -56,6 +78,29 @@ typedef struct sshv2_message_tag
        *end;
 } sshv2_message;
 
+typedef struct sshv2_read_request_tag
+{
+  guint32 id,
+          len;              /* Number of bytes requested */
+  guint64 offset;           /* Offset of the first requested byte */
+  char *buffer;             /* Holds a reply that arrived before it was needed.
+                               This is kept for the next request in this slot */
+  size_t buffer_len;
+  char *data;               /* Payload in buffer not yet given to the caller */
+  guint32 data_len,
+          received_len,     /* Size of the payload that the server sent */
+          status;           /* SSH_FX_* code if the reply was SSH_FXP_STATUS */
+  unsigned int received : 1,
+               is_status : 1;
+} sshv2_read_request;
+
+typedef struct sshv2_write_request_tag
+{
+  guint32 id,
+          len;
+  unsigned int acked : 1;
+} sshv2_write_request;
+
 typedef struct sshv2_params_tag
 {
   char handle[SSH_MAX_HANDLE_SIZE + 4], /* We'll encode the ID in here too */
@@ -66,10 +111,37 @@ typedef struct sshv2_params_tag
           count;
   sshv2_message message;
 
+  /* Limits for this connection, and a receive buffer of max_packet bytes
+     that the transfer replies are read into */
+  size_t max_packet,
+         max_read,
+         max_write;
+  char *recv_buffer;
+  size_t recv_buffer_len;
+
   unsigned int initialized : 1,
-               dont_log_status : 1;              /* For uploading files */
+               dont_log_status : 1,              /* For uploading files */
+               read_eof : 1;
 
   guint64 offset;
+
+  /* Read-ahead state for downloads. reads is a ring buffer of the
+     SSH_FXP_READ requests that are outstanding, ordered by offset */
+  sshv2_read_request * reads;
+  guint32 read_window,
+          reads_head,
+          reads_count;
+  guint64 read_offset;   /* Offset of the next SSH_FXP_READ to send */
+  off_t read_filesize;   /* Size of the file when it was opened */
+
+  /* Write-behind state for uploads. The SSH_FXP_WRITE requests that have
+     not been acknowledged yet, in the order they were sent */
+  sshv2_write_request writes[SSH_MAX_WRITES_IN_FLIGHT];
+  guint32 writes_head,
+          writes_count;
+  size_t write_bytes,    /* Bytes sent but not acknowledged */
+         write_limit;
+  int write_error;       /* First error the server returned for a write */
 } sshv2_params;
 
 
@@ -613,7 +685,7 @@ sshv2_log_command (gftp_request * request, gftp_logging_level level,
   params = request->protocol_data;
   memcpy (&id, message, 4);
   id = ntohl (id);
-  switch (type)
+  switch ((unsigned char) type)
     {
       case SSH_FXP_DATA:
       case SSH_FXP_READ:
@@ -731,6 +803,15 @@ sshv2_log_command (gftp_request * request, gftp_logging_level level,
         request->logging_function (level, request, 
                                    "%d: File handle\n", id);
         break;
+      case SSH_FXP_EXTENDED:
+        request->logging_function (level, request, 
+                                   _("%d: Extended request %s\n"), id,
+                                   message + 8);
+        break;
+      case SSH_FXP_EXTENDED_REPLY:
+        request->logging_function (level, request, 
+                                   _("%d: Extended reply\n"), id);
+        break;
       case SSH_FXP_NAME:
         memcpy (&num, message + 4, 4);
         num = ntohl (num);
@@ -746,37 +827,52 @@ sshv2_log_command (gftp_request * request, gftp_logging_level level,
 
 
 static int
-sshv2_send_command (gftp_request * request, char type, char *command, 
-                    size_t len)
+sshv2_send_packet (gftp_request * request, char type, char *command,
+                   size_t len, char *data, size_t data_len)
 {
-  char buf[34000];
+  sshv2_params * params;
+  struct iovec iov[3];
+  char header[5];
   guint32 clen;
   int ret;
 
-  if (len > 33995)
+  params = request->protocol_data;
+
+  if (len + data_len + 1 > params->max_packet)
     {
       request->logging_function (gftp_logging_error, request,
-                             _("Error: Message size %d too big\n"), len);
+                             _("Error: Message size %d too big\n"),
+                             len + data_len);
       gftp_disconnect (request);
       return (GFTP_EFATAL);
     }
 
-  clen = htonl (len + 1);
-  memcpy (buf, &clen, 4);
-  buf[4] = type;
-  memcpy (&buf[5], command, len);
-  buf[len + 5] = '\0';
+  clen = htonl (len + data_len + 1);
+  memcpy (header, &clen, 4);
+  header[4] = type;
+
+  /* The header, the command and the file data (for writes) are handed to
+     writev() as they are so that nothing has to be copied */
+  iov[0].iov_base = header;
+  iov[0].iov_len = 5;
+  iov[1].iov_base = command;
+  iov[1].iov_len = len;
+  iov[2].iov_base = data;
+  iov[2].iov_len = data_len;
 
 #ifdef DEBUG
   printf ("\rSending to FD %d: ", request->datafd);
-  for (clen=0; clen<len + 5; clen++)
-    printf ("%x ", buf[clen] & 0xff);
+  for (clen=0; clen<5; clen++)
+    printf ("%x ", header[clen] & 0xff);
+  for (clen=0; clen<len; clen++)
+    printf ("%x ", command[clen] & 0xff);
   printf ("\n");
 #endif
 
-  sshv2_log_command (request, gftp_logging_send, type, buf + 5, len);
+  sshv2_log_command (request, gftp_logging_send, type, command, len);
 
-  if ((ret = gftp_fd_write (request, buf, len + 5, request->datafd)) < 0)
+  if ((ret = gftp_fd_writev (request, iov, data_len > 0 ? 3 : 2,
+                             request->datafd)) < 0)
     return (ret);
 
   return (0);
@@ -784,33 +880,57 @@ sshv2_send_command (gftp_request * request, char type, char *command,
 
 
 static int
-sshv2_read_response (gftp_request * request, sshv2_message * message,
-                     int fd)
+sshv2_send_command (gftp_request * request, char type, char *command, 
+                    size_t len)
 {
-  char buf[6], error_buffer[255], *pos;
-  sshv2_params * params;
-  ssize_t numread;
-  size_t rem;
+  return (sshv2_send_packet (request, type, command, len, NULL, 0));
+}
 
-  params = request->protocol_data;
 
-  if (fd <= 0)
-    fd = request->datafd;
+static int
+sshv2_read_exact (gftp_request * request, char *buf, size_t len, int fd)
+{
+  ssize_t numread;
 
-  pos = buf;
-  rem = 5;
-  while (rem > 0)
+  while (len > 0)
     {
-      if ((numread = gftp_fd_read (request, pos, rem, fd)) < 0)
+      if ((numread = gftp_fd_read (request, buf, len, fd)) < 0)
         return (numread);
-      rem -= numread;
-      pos += numread;
+      else if (numread == 0)
+        {
+          request->logging_function (gftp_logging_error, request,
+                     _("Error: Could not read from socket: %s\n"),
+                     _("Connection closed"));
+          gftp_disconnect (request);
+          return (GFTP_ERETRYABLE);
+        }
+
+      len -= numread;
+      buf += numread;
     }
+
+  return (0);
+}
+
+
+static int
+sshv2_read_response_header (gftp_request * request, sshv2_message * message,
+                            int fd)
+{
+  char buf[6], error_buffer[255];
+  sshv2_params * params;
+  ssize_t numread;
+  int ret;
+
+  params = request->protocol_data;
+
+  if ((ret = sshv2_read_exact (request, buf, 5, fd)) < 0)
+    return (ret);
   buf[5] = '\0';
 
   memcpy (&message->length, buf, 4);
   message->length = ntohl (message->length);
-  if (message->length > 34000)
+  if (message->length == 0 || message->length > params->max_packet)
     {
       if (params->initialized)
         {
@@ -825,10 +945,9 @@ sshv2_read_response (gftp_request * request, sshv2_message * message,
 
           request->logging_function (gftp_logging_error, request, "%s", buf);
 
-          if (gftp_fd_set_sockblocking (request, fd, 0) == -1)
-            return (GFTP_EFATAL);
-
-          if ((numread = gftp_fd_read (NULL, error_buffer, 
+          /* The socket stays non-blocking, so that a server that sends
+             nothing more can't hold the request past the network timeout */
+          if ((numread = gftp_fd_read (request, error_buffer, 
                                           sizeof (error_buffer) - 1, 
                                           fd)) > 0)
             {
@@ -844,45 +963,74 @@ sshv2_read_response (gftp_request * request, sshv2_message * message,
     }
 
   message->command = buf[4];
-  message->buffer = g_malloc0 (message->length + 1);
+  return (0);
+}
+
+
+static int
+sshv2_read_response_body (gftp_request * request, sshv2_message * message,
+                          int fd)
+{
+  int ret;
 
   message->pos = message->buffer;
   message->end = message->buffer + message->length - 1;
 
-  pos = message->buffer;
-  rem = message->length - 1;
-  while (rem > 0)
-    {
-      if ((numread = gftp_fd_read (request, pos, rem, fd)) < 0)
-        return (numread);
-      rem -= numread;
-      pos += numread;
-    }
+  if ((ret = sshv2_read_exact (request, message->buffer,
+                               message->length - 1, fd)) < 0)
+    return (ret);
 
 #ifdef DEBUG
   printf ("\rReceived message: ");
-  for (rem=0; rem<message->length; rem++)
-    printf ("%x ", message->buffer[rem] & 0xff);
+  for (ret=0; ret<message->length; ret++)
+    printf ("%x ", message->buffer[ret] & 0xff);
   printf ("\n");
 #endif
 
-  message->buffer[message->length] = '\0';
+  message->buffer[message->length - 1] = '\0';
 
   sshv2_log_command (request, gftp_logging_recv, message->command, 
                      message->buffer, message->length);
   
-  return (message->command);
+  return ((unsigned char) message->command);
 }
 
 
-static void
-sshv2_destroy (gftp_request * request)
+static int
+sshv2_read_response (gftp_request * request, sshv2_message * message,
+                     int fd)
 {
-  g_return_if_fail (request != NULL);
-  g_return_if_fail (request->protonum == GFTP_PROTOCOL_SSH2);
+  int ret;
 
-  g_free (request->protocol_data);
-  request->protocol_data = NULL;
+  if (fd <= 0)
+    fd = request->datafd;
+
+  if ((ret = sshv2_read_response_header (request, message, fd)) < 0)
+    return (ret);
+
+  message->buffer = g_malloc0 (message->length + 1);
+  return (sshv2_read_response_body (request, message, fd));
+}
+
+
+/* Reads the next message into the connection's receive buffer instead of
+   allocating one. The message is only valid until the next read, and must
+   not be freed or passed to sshv2_wrong_response() */
+static int
+sshv2_read_response_into_buffer (gftp_request * request,
+                                 sshv2_message * message)
+{
+  sshv2_params * params;
+  int ret;
+
+  params = request->protocol_data;
+
+  if ((ret = sshv2_read_response_header (request, message,
+                                         request->datafd)) < 0)
+    return (ret);
+
+  message->buffer = params->recv_buffer;
+  return (sshv2_read_response_body (request, message, request->datafd));
 }
 
 
@@ -895,6 +1043,118 @@ sshv2_message_free (sshv2_message * message)
 }
 
 
+static void
+sshv2_set_limits (sshv2_params * params, guint64 max_packet,
+                  guint64 max_read, guint64 max_write)
+{
+  if (max_packet == 0 || max_packet > SSH_MAX_PACKET_SIZE)
+    max_packet = SSH_MAX_PACKET_SIZE;
+  else if (max_packet < SSH_MIN_PACKET_SIZE)
+    max_packet = SSH_MIN_PACKET_SIZE;
+  params->max_packet = max_packet;
+
+  /* Leave room for the headers of the SSH_FXP_DATA and SSH_FXP_WRITE
+     packets */
+  params->max_read = max_read > 0 ? max_read : SSH_DEFAULT_MAX_READ;
+  if (params->max_read > params->max_packet - 9)
+    params->max_read = params->max_packet - 9;
+
+  params->max_write = max_write > 0 ? max_write : SSH_DEFAULT_MAX_WRITE;
+  if (params->max_write > params->max_packet - SSH_MAX_HANDLE_SIZE - 32)
+    params->max_write = params->max_packet - SSH_MAX_HANDLE_SIZE - 32;
+
+  if (params->recv_buffer_len < params->max_packet + 1)
+    {
+      params->recv_buffer_len = params->max_packet + 1;
+      params->recv_buffer = g_realloc (params->recv_buffer,
+                                       params->recv_buffer_len);
+    }
+}
+
+
+static void
+sshv2_reset_read_ahead (sshv2_params * params)
+{
+  params->reads_head = 0;
+  params->reads_count = 0;
+  params->read_eof = 0;
+}
+
+
+static void
+sshv2_free_read_ahead (sshv2_params * params)
+{
+  guint32 i;
+
+  if (params->reads != NULL)
+    {
+      for (i = 0; i < params->read_window; i++)
+        {
+          if (params->reads[i].buffer != NULL)
+            g_free (params->reads[i].buffer);
+        }
+
+      g_free (params->reads);
+      params->reads = NULL;
+    }
+
+  params->read_window = 0;
+  sshv2_reset_read_ahead (params);
+}
+
+
+static int
+sshv2_drain_read_ahead (gftp_request * request)
+{
+  sshv2_params * params;
+  sshv2_message message;
+  guint32 i, pending;
+  int ret;
+
+  params = request->protocol_data;
+
+  pending = 0;
+  for (i = 0; i < params->reads_count; i++)
+    {
+      if (!params->reads[(params->reads_head + i) % params->read_window].received)
+        pending++;
+    }
+
+  /* Don't log the EOF replies to reads past the end of the file */
+  ret = 0;
+  params->dont_log_status = 1;
+  for (; pending > 0; pending--)
+    {
+      if ((ret = sshv2_read_response_into_buffer (request, &message)) < 0)
+        break;
+    }
+  params->dont_log_status = 0;
+
+  params->reads_head = 0;
+  params->reads_count = 0;
+
+  return (ret < 0 ? ret : 0);
+}
+
+
+static void
+sshv2_destroy (gftp_request * request)
+{
+  sshv2_params * params;
+
+  g_return_if_fail (request != NULL);
+  g_return_if_fail (request->protonum == GFTP_PROTOCOL_SSH2);
+
+  params = request->protocol_data;
+  sshv2_free_read_ahead (params);
+  if (params->recv_buffer != NULL)
+    g_free (params->recv_buffer);
+
+  g_free (request->protocol_data);
+  request->protocol_data = NULL;
+}
+
+
 static int
 sshv2_wrong_response (gftp_request * request, sshv2_message * message)
 {
@@ -965,6 +1225,90 @@ sshv2_response_return_code (gftp_request * request, sshv2_message * message,
 }
 
 
+static void
+sshv2_reset_write_behind (sshv2_params * params)
+{
+  params->writes_head = 0;
+  params->writes_count = 0;
+  params->write_bytes = 0;
+  params->write_error = 0;
+}
+
+
+static int
+sshv2_collect_write_status (gftp_request * request)
+{
+  sshv2_write_request * wreq;
+  sshv2_params * params;
+  sshv2_message message;
+  guint32 id, num, i;
+  int ret;
+
+  params = request->protocol_data;
+
+  params->dont_log_status = 1;
+  ret = sshv2_read_response_into_buffer (request, &message);
+  params->dont_log_status = 0;
+  if (ret < 0)
+    return (ret);
+
+  if (ret != SSH_FXP_STATUS || message.length < 9)
+    return (sshv2_wrong_response (request, NULL));
+
+  memcpy (&id, message.buffer, 4);
+  id = ntohl (id);
+
+  wreq = NULL;
+  for (i = 0; i < params->writes_count; i++)
+    {
+      wreq = &params->writes[(params->writes_head + i) % SSH_MAX_WRITES_IN_FLIGHT];
+      if (!wreq->acked && wreq->id == id)
+        break;
+    }
+
+  if (i == params->writes_count)
+    return (sshv2_wrong_response (request, NULL));
+
+  wreq->acked = 1;
+  params->write_bytes -= wreq->len;
+
+  memcpy (&num, message.buffer + 4, 4);
+  num = ntohl (num);
+  if (num != SSH_FX_OK && params->write_error == 0)
+    {
+      sshv2_log_command (request, gftp_logging_recv, SSH_FXP_STATUS,
+                         message.buffer, message.length);
+      params->write_error = sshv2_response_return_code (request, NULL, num);
+    }
+
+  while (params->writes_count > 0 &&
+         params->writes[params->writes_head].acked)
+    {
+      params->writes_head = (params->writes_head + 1) % SSH_MAX_WRITES_IN_FLIGHT;
+      params->writes_count--;
+    }
+
+  return (0);
+}
+
+
+static int
+sshv2_drain_write_behind (gftp_request * request)
+{
+  sshv2_params * params;
+  int ret;
+
+  params = request->protocol_data;
+  while (params->writes_count > 0)
+    {
+      if ((ret = sshv2_collect_write_status (request)) < 0)
+        return (ret);
+    }
+
+  return (0);
+}
+
+
 static int
 sshv2_buffer_get_int32 (gftp_request * request, sshv2_message * message,
                         unsigned int expected_response, int check_response,
@@ -1139,11 +1483,85 @@ sshv2_free_args (char **args)
 }
 
 
+static int
+sshv2_has_extension (gftp_request * request, sshv2_message * message,
+                     const char *extension)
+{
+  char *name;
+  int found;
+
+  /* The version is followed by pairs of extension names and data */
+  found = 0;
+  message->pos = message->buffer + 4;
+  while (!found && message->end - message->pos >= 8)
+    {
+      if ((name = sshv2_buffer_get_string (request, message, 1)) == NULL)
+        return (0);
+
+      found = strcmp (name, extension) == 0;
+      g_free (name);
+
+      sshv2_buffer_get_string (request, message, 0);
+    }
+
+  return (found);
+}
+
+
+static int
+sshv2_get_limits (gftp_request * request)
+{
+  gint64 max_packet, max_read, max_write;
+  sshv2_params * params;
+  sshv2_message message;
+  char *tempstr;
+  size_t len;
+  int ret;
+
+  params = request->protocol_data;
+
+  len = strlen (SSH_LIMITS_EXTENSION) + 4;
+  tempstr = sshv2_initialize_buffer (request, len);
+  sshv2_add_string_to_buf (tempstr + 4, SSH_LIMITS_EXTENSION,
+                          strlen (SSH_LIMITS_EXTENSION));
+
+  ret = sshv2_send_command (request, SSH_FXP_EXTENDED, tempstr, len);
+  g_free (tempstr);
+  if (ret < 0)
+    return (ret);
+
+  memset (&message, 0, sizeof (message));
+  if ((ret = sshv2_read_response (request, &message, -1)) < 0)
+    return (ret);
+  else if (ret != SSH_FXP_EXTENDED_REPLY)
+    {
+      /* Keep the defaults */
+      sshv2_message_free (&message);
+      return (0);
+    }
+
+  message.pos += 4;
+  if ((ret = sshv2_buffer_get_int64 (request, &message, 0, 0, &max_packet)) < 0 ||
+      (ret = sshv2_buffer_get_int64 (request, &message, 0, 0, &max_read)) < 0 ||
+      (ret = sshv2_buffer_get_int64 (request, &message, 0, 0, &max_write)) < 0)
+    return (ret);
+
+  sshv2_message_free (&message);
+
+  sshv2_set_limits (params, max_packet, max_read, max_write);
+  request->logging_function (gftp_logging_misc, request,
+                             _("Server packet limits: %d bytes, %d bytes per read, %d bytes per write\n"),
+                             (int) params->max_packet, (int) params->max_read,
+                             (int) params->max_write);
+  return (0);
+}
+
+
 static int sshv2_connect (gftp_request * request)
 {
+  int ret, fdm, ptymfd, has_limits;
   sshv2_params * params;
   sshv2_message message;
-  int ret, fdm, ptymfd;
   guint32 version;
   char **args;
   pid_t child;
@@ -1178,6 +1596,10 @@ static int sshv2_connect (gftp_request * request)
 
   request->datafd = fdm;
 
+  /* The limits of the previous server don't apply to this one */
+  sshv2_set_limits (params, SSH_DEFAULT_MAX_PACKET, SSH_DEFAULT_MAX_READ,
+                    SSH_DEFAULT_MAX_WRITE);
+
   version = htonl (SSH_MY_VERSION);
   if ((ret = sshv2_send_command (request, SSH_FXP_INIT, (char *) 
                                  &version, 4)) < 0)
@@ -1197,9 +1619,13 @@ static int sshv2_connect (gftp_request * request)
   else if (ret != SSH_FXP_VERSION)
     return (sshv2_wrong_response (request, &message));
 
+  has_limits = sshv2_has_extension (request, &message, SSH_LIMITS_EXTENSION);
   sshv2_message_free (&message);
 
   params->initialized = 1;
+  if (has_limits && (ret = sshv2_get_limits (request)) < 0)
+    return (ret);
+
   request->logging_function (gftp_logging_misc, request,
                              _("Successfully logged into SSH server %s\n"),
                              request->hostname);
@@ -1250,6 +1676,8 @@ sshv2_disconnect (gftp_request * request)
       sshv2_message_free (&params->message);
       params->message.buffer = NULL;
     }
+
+  sshv2_reset_write_behind (params);
 }
 
 
@@ -1258,8 +1686,8 @@ sshv2_end_transfer (gftp_request * request)
 {
   sshv2_params * params;
   sshv2_message message;
+  int ret, write_error;
   guint32 len;
-  int ret;
 
   g_return_val_if_fail (request != NULL, GFTP_EFATAL);
   g_return_val_if_fail (request->protonum == GFTP_PROTOCOL_SSH2, GFTP_EFATAL);
@@ -1272,6 +1700,22 @@ sshv2_end_transfer (gftp_request * request)
       params->count = 0;
     }
 
+  if (params->reads_count > 0 && request->datafd > 0 &&
+      (ret = sshv2_drain_read_ahead (request)) < 0)
+    return (ret);
+
+  sshv2_reset_read_ahead (params);
+
+  /* Wait for the outstanding writes before closing the handle. An error
+     that the server returned for any of them is reported once the handle
+     is closed */
+  if (params->writes_count > 0 && request->datafd > 0 &&
+      (ret = sshv2_drain_write_behind (request)) < 0)
+    return (ret);
+
+  write_error = params->write_error;
+  sshv2_reset_write_behind (params);
+
   if (params->handle_len > 0)
     {
       len = htonl (params->id++);
@@ -1292,11 +1736,11 @@ sshv2_end_transfer (gftp_request * request)
 
   if (params->transfer_buffer != NULL)
     {
-      g_free (params->transfer_buffer);
+      gftp_buffer_put (params->transfer_buffer, params->transfer_buffer_len);
       params->transfer_buffer = NULL;
     }
 
-  return (0);
+  return (write_error);
 }
 
 
@@ -1438,12 +1882,6 @@ sshv2_get_next_file (gftp_request * request, gftp_file * fle, int fd)
 
   params = request->protocol_data;
 
-  if (request->last_dir_entry)
-    {
-      g_free (request->last_dir_entry);
-      request->last_dir_entry = NULL;
-      request->last_dir_entry_len = 0;
-    }
   retsize = 0;
 
   if (params->count > 0)
@@ -1467,17 +1905,6 @@ sshv2_get_next_file (gftp_request * request, gftp_file * fle, int fd)
       if ((ret = sshv2_read_response (request, &params->message, fd)) < 0)
         return (ret);
 
-      if (!request->cached)
-        {
-          request->last_dir_entry = g_malloc0 (params->message.length + 4);
-          len = htonl (params->message.length);
-          memcpy (request->last_dir_entry, &len, 4);
-          request->last_dir_entry[4] = params->message.command;
-          memcpy (request->last_dir_entry + 5, params->message.buffer, 
-                  params->message.length - 1);
-          request->last_dir_entry_len = params->message.length + 4;
-        }
-
       if (ret == SSH_FXP_NAME)
         {
           params->message.pos = params->message.buffer + 4;
@@ -1847,12 +2274,38 @@ sshv2_open_file (gftp_request * request, const char *file, off_t startsize,
 static off_t
 sshv2_get_file (gftp_request * request, const char *file, off_t startsize)
 {
+  sshv2_params * params;
+  intptr_t read_ahead;
+  off_t size;
   int ret;
 
   if ((ret = sshv2_open_file (request, file, startsize, SSH_FXF_READ)) < 0)
     return (ret);
 
-  return (sshv2_get_file_size (request, file));
+  if ((size = sshv2_get_file_size (request, file)) < 0)
+    return (size);
+
+  gftp_lookup_request_option (request, "ssh_read_ahead", &read_ahead);
+  if (read_ahead < 1)
+    read_ahead = 1;
+  else if (read_ahead > SSH_MAX_READ_AHEAD)
+    read_ahead = SSH_MAX_READ_AHEAD;
+
+  /* The slots, and the buffers in them, are kept from the last download */
+  params = request->protocol_data;
+  if (params->reads == NULL || params->read_window != read_ahead)
+    {
+      sshv2_free_read_ahead (params);
+      params->reads = g_malloc0 (sizeof (*params->reads) * read_ahead);
+      params->read_window = read_ahead;
+    }
+  else
+    sshv2_reset_read_ahead (params);
+
+  params->read_offset = startsize;
+  params->read_filesize = size;
+
+  return (size);
 }
 
 
@@ -1860,6 +2313,8 @@ static int
 sshv2_put_file (gftp_request * request, const char *file,
                 off_t startsize, off_t totalsize)
 {
+  sshv2_params * params;
+  intptr_t write_behind;
   guint32 mode;
   int ret;
 
@@ -1871,87 +2326,304 @@ sshv2_put_file (gftp_request * request, const char *file,
   if ((ret = sshv2_open_file (request, file, startsize, mode)) < 0)
     return (ret);
 
+  gftp_lookup_request_option (request, "ssh_write_behind", &write_behind);
+
+  params = request->protocol_data;
+  sshv2_reset_write_behind (params);
+  params->write_limit = write_behind > 0 ? write_behind * 1024 : 0;
+
   return (0);
 }
 
 
 static void
-sshv2_setup_file_offset (sshv2_params * params, char *buf)
+sshv2_setup_file_offset (sshv2_params * params, char *buf, guint64 offset)
 {
   guint32 hinum, lownum;
-  hinum = htonl(params->offset >> 32);
-  lownum = htonl((guint32) params->offset);
+  hinum = htonl(offset >> 32);
+  lownum = htonl((guint32) offset);
 
   memcpy (buf + params->handle_len, &hinum, 4);
   memcpy (buf + params->handle_len + 4, &lownum, 4);
 }
 
 
-static ssize_t 
-sshv2_get_next_file_chunk (gftp_request * request, char *buf, size_t size)
+static sshv2_read_request *
+sshv2_read_ahead_slot (sshv2_params * params, guint32 num)
+{
+  return (&params->reads[(params->reads_head + num) % params->read_window]);
+}
+
+
+static int
+sshv2_issue_read (gftp_request * request, sshv2_read_request * rreq)
 {
   sshv2_params * params;
-  sshv2_message message;
   guint32 num;
-  int ret;
-
-  g_return_val_if_fail (request != NULL, GFTP_EFATAL);
-  g_return_val_if_fail (request->protonum == GFTP_PROTOCOL_SSH2, GFTP_EFATAL);
-  g_return_val_if_fail (request->datafd > 0, GFTP_EFATAL);
-  g_return_val_if_fail (buf != NULL, GFTP_EFATAL);
 
   params = request->protocol_data;
 
   if (params->transfer_buffer == NULL)
     {
       params->transfer_buffer_len = params->handle_len + 12;
-      params->transfer_buffer = g_malloc0 (params->transfer_buffer_len);
+      params->transfer_buffer = gftp_buffer_get (params->transfer_buffer_len);
       memcpy (params->transfer_buffer, params->handle, params->handle_len);
     }
 
-  num = htonl (params->id++);
+  rreq->id = params->id++;
+  rreq->received = 0;
+  rreq->is_status = 0;
+  rreq->data = NULL;
+  rreq->data_len = 0;
+
+  num = htonl (rreq->id);
   memcpy (params->transfer_buffer, &num, 4);
 
-  sshv2_setup_file_offset (params, params->transfer_buffer);
+  sshv2_setup_file_offset (params, params->transfer_buffer, rreq->offset);
 
-  num = htonl (size);
+  num = htonl (rreq->len);
   memcpy (params->transfer_buffer + params->handle_len + 8, &num, 4);
-  
-  if ((ret = sshv2_send_command (request, SSH_FXP_READ, params->transfer_buffer,
-                                 params->handle_len + 12)) < 0)
+
+  return (sshv2_send_command (request, SSH_FXP_READ, params->transfer_buffer,
+                              params->handle_len + 12));
+}
+
+
+static int
+sshv2_send_read_request (gftp_request * request, size_t size)
+{
+  sshv2_read_request * rreq;
+  sshv2_params * params;
+  int ret;
+
+  params = request->protocol_data;
+
+  rreq = sshv2_read_ahead_slot (params, params->reads_count);
+  rreq->offset = params->read_offset;
+  rreq->len = size;
+
+  if ((ret = sshv2_issue_read (request, rreq)) < 0)
     return (ret);
 
-  memset (&message, 0, sizeof (message));
-  if ((ret = sshv2_read_response (request, &message, -1)) != SSH_FXP_DATA)
+  params->reads_count++;
+  params->read_offset += size;
+  return (0);
+}
+
+
+/* Reads the next reply to one of the outstanding reads. If it is the data
+   for the first outstanding read and it fits, the payload is read straight
+   into buf. Otherwise it is stored in the slot of the read it belongs to */
+static int
+sshv2_read_ahead_receive (gftp_request * request, char *buf, size_t size)
+{
+  sshv2_read_request * rreq;
+  sshv2_params * params;
+  sshv2_message message;
+  char header[8];
+  guint32 id, num, i;
+  int ret;
+
+  params = request->protocol_data;
+
+  if ((ret = sshv2_read_response_header (request, &message,
+                                         request->datafd)) < 0)
+    return (ret);
+
+  if ((message.command != SSH_FXP_DATA && message.command != SSH_FXP_STATUS) ||
+      message.length < 9)
+    return (sshv2_wrong_response (request, NULL));
+
+  if ((ret = sshv2_read_exact (request, header,
+                               message.command == SSH_FXP_DATA ? 8 : 4,
+                               request->datafd)) < 0)
+    return (ret);
+
+  memcpy (&id, header, 4);
+  id = ntohl (id);
+
+  rreq = NULL;
+  for (i = 0; i < params->reads_count; i++)
     {
-      if (ret < 0)
+      rreq = sshv2_read_ahead_slot (params, i);
+      if (!rreq->received && rreq->id == id)
+        break;
+    }
+
+  if (i == params->reads_count)
+    return (sshv2_wrong_response (request, NULL));
+
+  if (message.command == SSH_FXP_STATUS)
+    {
+      memcpy (params->recv_buffer, header, 4);
+      if ((ret = sshv2_read_exact (request, params->recv_buffer + 4,
+                                   message.length - 5, request->datafd)) < 0)
         return (ret);
+      params->recv_buffer[message.length - 1] = '\0';
 
-      message.pos += 4;
-      if ((ret = sshv2_buffer_get_int32 (request, &message, SSH_FX_EOF, 1,
-                                         NULL)) < 0)
-        return (ret); 
+      sshv2_log_command (request, gftp_logging_recv, SSH_FXP_STATUS,
+                         params->recv_buffer, message.length);
 
-      sshv2_message_free (&message);
+      memcpy (&num, params->recv_buffer + 4, 4);
+      rreq->status = ntohl (num);
+      rreq->is_status = 1;
+      rreq->received_len = 0;
+      rreq->received = 1;
       return (0);
     }
 
-  memcpy (&num, message.buffer + 4, 4);
+  memcpy (&num, header + 4, 4);
   num = ntohl (num);
-  if (num > size)
+  if (num > rreq->len)
     {
       request->logging_function (gftp_logging_error, request,
                              _("Error: Message size %d too big from server\n"),
                              num);
-      sshv2_message_free (&message);
       gftp_disconnect (request);
       return (GFTP_ERETRYABLE);
-        
     }
+  else if (num != message.length - 9)
+    return (sshv2_wrong_response (request, NULL));
 
-  memcpy (buf, message.buffer + 8, num);
-  sshv2_message_free (&message);
+  if (i == 0 && buf != NULL && num <= size)
+    {
+      if ((ret = sshv2_read_exact (request, buf, num, request->datafd)) < 0)
+        return (ret);
+
+      rreq->data = NULL;
+      rreq->data_len = 0;
+    }
+  else
+    {
+      if (rreq->buffer_len < num)
+        {
+          rreq->buffer_len = num;
+          rreq->buffer = g_realloc (rreq->buffer, rreq->buffer_len);
+        }
+
+      if ((ret = sshv2_read_exact (request, rreq->buffer, num,
+                                   request->datafd)) < 0)
+        return (ret);
+
+      rreq->data = rreq->buffer;
+      rreq->data_len = num;
+    }
+
+  rreq->received_len = num;
+  rreq->received = 1;
+  return (0);
+}
+
+
+/* Called once all of the data of the first outstanding read has been
+   handed out */
+static int
+sshv2_read_ahead_done (gftp_request * request, sshv2_read_request * rreq)
+{
+  sshv2_params * params;
+
+  params = request->protocol_data;
+
+  if (rreq->received_len < rreq->len)
+    {
+      /* Short read. The rest of this range has to be requested again
+         before anything that is queued after it can be handed out */
+      rreq->offset += rreq->received_len;
+      rreq->len -= rreq->received_len;
+      return (sshv2_issue_read (request, rreq));
+    }
+
+  params->reads_head = (params->reads_head + 1) % params->read_window;
+  params->reads_count--;
+  return (0);
+}
+
+
+static ssize_t 
+sshv2_get_next_file_chunk (gftp_request * request, char *buf, size_t size)
+{
+  sshv2_read_request * rreq;
+  sshv2_params * params;
+  size_t chunk_size;
+  guint32 num;
+  int ret;
+
+  g_return_val_if_fail (request != NULL, GFTP_EFATAL);
+  g_return_val_if_fail (request->protonum == GFTP_PROTOCOL_SSH2, GFTP_EFATAL);
+  g_return_val_if_fail (request->datafd > 0, GFTP_EFATAL);
+  g_return_val_if_fail (buf != NULL, GFTP_EFATAL);
+
+  params = request->protocol_data;
+  g_return_val_if_fail (params->reads != NULL, GFTP_EFATAL);
+
+  if (params->read_eof)
+    return (0);
+
+  chunk_size = size > params->max_read ? params->max_read : size;
+
+  while (1)
+    {
+      /* Keep the window full. Nothing is requested past the size the file
+         had when it was opened, except for one read that is always kept
+         outstanding so that EOF (or data appended since) is noticed */
+      while (params->reads_count < params->read_window &&
+             (params->reads_count == 0 ||
+              params->read_offset < (guint64) params->read_filesize))
+        {
+          if ((ret = sshv2_send_read_request (request, chunk_size)) < 0)
+            return (ret);
+        }
+
+      rreq = sshv2_read_ahead_slot (params, 0);
+      while (!rreq->received)
+        {
+          if ((ret = sshv2_read_ahead_receive (request, buf, size)) < 0)
+            return (ret);
+        }
+
+      if (rreq->is_status)
+        {
+          if (rreq->status == SSH_FX_EOF)
+            ret = 0;
+          else
+            ret = sshv2_response_return_code (request, NULL, rreq->status);
+
+          params->read_eof = 1;
+
+          if (request->datafd > 0 && sshv2_drain_read_ahead (request) < 0)
+            return (GFTP_ERETRYABLE);
+
+          return (ret);
+        }
+
+      if (rreq->data == NULL && rreq->received_len > 0)
+        {
+          /* The payload was read straight into buf */
+          num = rreq->received_len;
+          params->offset += num;
+          if ((ret = sshv2_read_ahead_done (request, rreq)) < 0)
+            return (ret);
+
+          return (num);
+        }
+
+      if (rreq->data_len > 0)
+        break;
+
+      /* The server sent back an empty SSH_FXP_DATA packet */
+      if ((ret = sshv2_issue_read (request, rreq)) < 0)
+        return (ret);
+    }
+
+  num = rreq->data_len > size ? size : rreq->data_len;
+  memcpy (buf, rreq->data, num);
+  rreq->data += num;
+  rreq->data_len -= num;
   params->offset += num;
+
+  if (rreq->data_len == 0 && (ret = sshv2_read_ahead_done (request, rreq)) < 0)
+    return (ret);
+
   return (num);
 }
 
@@ -1959,8 +2631,8 @@ sshv2_get_next_file_chunk (gftp_request * request, char *buf, size_t size)
 static ssize_t 
 sshv2_put_next_file_chunk (gftp_request * request, char *buf, size_t size)
 {
+  sshv2_write_request * wreq;
   sshv2_params * params;
-  sshv2_message message;
   guint32 num;
   int ret;
 
@@ -1971,47 +2643,48 @@ sshv2_put_next_file_chunk (gftp_request * request, char *buf, size_t size)
 
   params = request->protocol_data;
 
+  if (size > params->max_write)
+    size = params->max_write;
+
+  /* Only wait for the server once too much data is unacknowledged */
+  while (params->writes_count > 0 &&
+         (params->writes_count == SSH_MAX_WRITES_IN_FLIGHT ||
+          params->write_bytes + size > params->write_limit))
+    {
+      if ((ret = sshv2_collect_write_status (request)) < 0)
+        return (ret);
+    }
+
+  if (params->write_error < 0)
+    return (params->write_error);
+
   if (params->transfer_buffer == NULL)
     {
-      params->transfer_buffer_len = params->handle_len + size + 12;
-      params->transfer_buffer = g_malloc0 (params->transfer_buffer_len);
+      params->transfer_buffer_len = params->handle_len + 12;
+      params->transfer_buffer = gftp_buffer_get (params->transfer_buffer_len);
       memcpy (params->transfer_buffer, params->handle, params->handle_len);
     }
 
-  num = htonl (params->id++);
+  wreq = &params->writes[(params->writes_head + params->writes_count) % SSH_MAX_WRITES_IN_FLIGHT];
+  wreq->id = params->id++;
+  wreq->len = size;
+  wreq->acked = 0;
+
+  num = htonl (wreq->id);
   memcpy (params->transfer_buffer, &num, 4);
 
-  sshv2_setup_file_offset (params, params->transfer_buffer);
+  sshv2_setup_file_offset (params, params->transfer_buffer, params->offset);
 
   num = htonl (size);
   memcpy (params->transfer_buffer + params->handle_len + 8, &num, 4);
-  memcpy (params->transfer_buffer + params->handle_len + 12, buf, size);
   
-  if ((ret = sshv2_send_command (request, SSH_FXP_WRITE,
-                                 params->transfer_buffer,
-                                 params->transfer_buffer_len)) < 0)
-    return (ret);
-
-  memset (&message, 0, sizeof (message));
-  params->dont_log_status = 1;
-  ret = sshv2_read_response (request, &message, -1);
-  if (ret < 0)
+  if ((ret = sshv2_send_packet (request, SSH_FXP_WRITE,
+                                params->transfer_buffer,
+                                params->handle_len + 12, buf, size)) < 0)
     return (ret);
 
-  params->dont_log_status = 0;
-  if (ret != SSH_FXP_STATUS)
-    return (sshv2_wrong_response (request, &message));
-
-  message.pos += 4;
-  if ((ret = sshv2_buffer_get_int32 (request, &message, SSH_FX_OK, 1, &num)) < 0)
-    {
-      if (num == SSH_FX_EOF)
-        return (0);
-
-      return (ret);
-    }
-
-  sshv2_message_free (&message);
+  params->writes_count++;
+  params->write_bytes += size;
   params->offset += size;
   return (size);
 }
@@ -2070,7 +2743,7 @@ sshv2_copy_param_options (gftp_request * dest_request,
   memcpy (dparms->handle, sparms->handle, sizeof (*dparms->handle));
   if (sparms->transfer_buffer != NULL)
     {
-      dparms->transfer_buffer = g_malloc0 (sparms->transfer_buffer_len);
+      dparms->transfer_buffer = gftp_buffer_get (sparms->transfer_buffer_len);
       memcpy (dparms->transfer_buffer, sparms->transfer_buffer,
               sparms->transfer_buffer_len);
     }
@@ -2082,6 +2755,7 @@ sshv2_copy_param_options (gftp_request * dest_request,
   dparms->id = sparms->id;
   dparms->count = sparms->count;
   dparms->handle_len = sparms->handle_len;
+  dparms->transfer_buffer_len = sparms->transfer_buffer_len;
   dparms->initialized = sparms->initialized;
   dparms->dont_log_status = sparms->dont_log_status;
   dparms->offset = sparms->offset;
@@ -2111,6 +2785,7 @@ sshv2_init (gftp_request * request)
   request->transfer_file = NULL;
   request->get_next_file_chunk = sshv2_get_next_file_chunk;
   request->put_next_file_chunk = sshv2_put_next_file_chunk;
+  request->get_raw_data_fd = NULL;
   request->end_transfer = sshv2_end_transfer;
   request->abort_transfer = sshv2_end_transfer; /* NOTE: uses sshv2_end_transfer */
   request->stat_filename = sshv2_stat_filename;
@@ -2138,6 +2813,8 @@ sshv2_init (gftp_request * request)
 
   params = request->protocol_data;
   params->id = 1;
+  sshv2_set_limits (params, SSH_DEFAULT_MAX_PACKET, SSH_DEFAULT_MAX_READ,
+                    SSH_DEFAULT_MAX_WRITE);
 
   return (gftp_set_config_options (request));
 }
@@ -48,16 +48,23 @@ static gftp_config_vars config_vars[] =
   {NULL, NULL, 0, NULL, NULL, 0, NULL, 0, NULL}
 };  
 
-static GMutex * gftp_ssl_mutexes = NULL;
 static volatile int gftp_ssl_initialized = 0;
 static SSL_CTX * ctx = NULL;
-static GHashTable * gftp_ssl_map = NULL;
 
-struct CRYPTO_dynlock_value
-{ 
-  GMutex mutex;
-};
+/* Sessions of the control connections by host and port. Reconnecting to a
+   server, from the same request or a copy of it, resumes the session
+   instead of doing a full handshake */
+#define GFTP_SSL_SESSION_CACHE_MAX 64
 
+/* How long a handshake waits on the socket between checks for cancellation */
+#define GFTP_SSL_WAIT_SLICE 250  /* msecs */
+
+static GHashTable * gftp_ssl_sessions = NULL;
+static WGMutex gftp_ssl_session_mutex;
+static int gftp_ssl_handshakes = 0;
+static int gftp_ssl_resumed = 0;
+static gint64 gftp_ssl_full_handshake_time = 0; /* usecs, running average */
+static gint64 gftp_ssl_time_saved = 0;
 
 void ssl_register_module (void)
 {
@@ -73,24 +80,12 @@ void ssl_register_module (void)
     }
 }
 
-static SSL* gftp_get_ssl_for_fd (int fd)
-{
-  //DEBUG_PRINT_FUNC
-  SSL* ssl= gftp_ssl_map?(SSL*)g_hash_table_lookup (gftp_ssl_map, &fd):NULL;
-  return ssl;
-}
+/* The SSL object of the control connection is request->ssl, the one of
+   the FTPS data connection is request->data_ssl */
 
-static void gftp_set_ssl_for_fd (int fd, SSL* ssl)
+static SSL ** gftp_ssl_for_fd (gftp_request * request, int fd)
 {
-  DEBUG_PRINT_FUNC
-  if (ssl)
-    {
-      int *key = g_new (gint, 1);
-      *key = fd;
-      g_hash_table_insert (gftp_ssl_map, key, ssl);
-    }
-  else
-    g_hash_table_remove (gftp_ssl_map, &fd);
+  return (fd == request->datafd ? &request->ssl : &request->data_ssl);
 }
 
 
@@ -106,6 +101,134 @@ static int gftp_ssl_get_index (void)
 }
 
 
+static char * gftp_ssl_session_key (gftp_request * request)
+{
+  return (g_strdup_printf ("%s:%u", request->hostname, request->port));
+}
+
+
+static gboolean gftp_ssl_session_expired (gpointer key, gpointer value,
+                                          gpointer data)
+{
+  SSL_SESSION * session = value;
+
+  return (!SSL_SESSION_is_resumable (session) ||
+          SSL_SESSION_get_time (session) +
+            SSL_SESSION_get_timeout (session) <= time (NULL));
+}
+
+
+/* Returns a reference to the cached session for the request's host, if
+   there is one that can still be resumed */
+
+static SSL_SESSION * gftp_ssl_get_cached_session (gftp_request * request)
+{
+  SSL_SESSION * session;
+  char *key;
+
+  if (request->hostname == NULL)
+    return (NULL);
+
+  key = gftp_ssl_session_key (request);
+  g_mutex_lock (&gftp_ssl_session_mutex);
+
+  session = g_hash_table_lookup (gftp_ssl_sessions, key);
+  if (session != NULL && gftp_ssl_session_expired (key, session, NULL))
+    {
+      g_hash_table_remove (gftp_ssl_sessions, key);
+      session = NULL;
+    }
+  else if (session != NULL)
+    SSL_SESSION_up_ref (session);
+
+  g_mutex_unlock (&gftp_ssl_session_mutex);
+  g_free (key);
+  return (session);
+}
+
+
+static void gftp_ssl_forget_session (gftp_request * request)
+{
+  char *key;
+
+  if (request->hostname == NULL)
+    return;
+
+  key = gftp_ssl_session_key (request);
+  g_mutex_lock (&gftp_ssl_session_mutex);
+  g_hash_table_remove (gftp_ssl_sessions, key);
+  g_mutex_unlock (&gftp_ssl_session_mutex);
+  g_free (key);
+}
+
+
+/* Called by OpenSSL for every session and TLS 1.3 ticket the server gives
+   us. Returning 1 keeps the reference */
+
+static int /* callback */
+gftp_ssl_new_session_callback (SSL * ssl, SSL_SESSION * session)
+{
+  gftp_request * request;
+
+  /* Data connections always resume the control connection's session */
+  request = SSL_get_ex_data (ssl, gftp_ssl_get_index ());
+  if (request == NULL || request->hostname == NULL ||
+      SSL_get_fd (ssl) != request->datafd)
+    return (0);
+
+  g_mutex_lock (&gftp_ssl_session_mutex);
+
+  if (g_hash_table_size (gftp_ssl_sessions) >= GFTP_SSL_SESSION_CACHE_MAX)
+    {
+      g_hash_table_foreach_remove (gftp_ssl_sessions, gftp_ssl_session_expired,
+                                   NULL);
+      if (g_hash_table_size (gftp_ssl_sessions) >= GFTP_SSL_SESSION_CACHE_MAX)
+        g_hash_table_remove_all (gftp_ssl_sessions);
+    }
+
+  g_hash_table_replace (gftp_ssl_sessions, gftp_ssl_session_key (request),
+                        session);
+
+  g_mutex_unlock (&gftp_ssl_session_mutex);
+  return (1);
+}
+
+
+static void gftp_ssl_log_handshake (gftp_request * request, SSL * ssl,
+                                    gint64 elapsed)
+{
+  int handshakes, resumed;
+  gint64 saved;
+
+  g_mutex_lock (&gftp_ssl_session_mutex);
+
+  handshakes = ++gftp_ssl_handshakes;
+  if (SSL_session_reused (ssl))
+    {
+      resumed = ++gftp_ssl_resumed;
+      if (gftp_ssl_full_handshake_time > elapsed)
+        gftp_ssl_time_saved += gftp_ssl_full_handshake_time - elapsed;
+    }
+  else
+    {
+      resumed = gftp_ssl_resumed;
+      if (gftp_ssl_full_handshake_time == 0)
+        gftp_ssl_full_handshake_time = elapsed;
+      else
+        gftp_ssl_full_handshake_time = (gftp_ssl_full_handshake_time * 7 +
+                                        elapsed) / 8;
+    }
+  saved = gftp_ssl_time_saved;
+
+  g_mutex_unlock (&gftp_ssl_session_mutex);
+
+  if (SSL_session_reused (ssl))
+    request->logging_function (gftp_logging_misc, request,
+                               _("Resumed SSL session (%d of %d handshakes resumed, %.1f ms saved)\n"),
+                               resumed, handshakes, (double) saved / 1000.0);
+}
+
+
 static int  gftp_ssl_verify_callback (int ok, X509_STORE_CTX *store)
 {
   DEBUG_PRINT_FUNC
@@ -147,7 +270,7 @@ static int gftp_ssl_post_connection_check (gftp_request * request)
   X509_EXTENSION *ext;
   X509_NAME *subj;
   X509 *cert;
-  SSL* ssl = gftp_get_ssl_for_fd (request->datafd);
+  SSL* ssl = request->ssl;
  
   ok = 0;
   if (!(cert = SSL_get_peer_certificate (ssl)))
@@ -254,77 +377,6 @@ static int gftp_ssl_post_connection_check (gftp_request * request)
 }
 
 
-void /* callback */
-_gftp_ssl_locking_function (int mode, int n, const char * file, int line)
-{
-  DEBUG_PRINT_FUNC
-  if (mode & CRYPTO_LOCK)
-    g_mutex_lock (&gftp_ssl_mutexes[n]);
-  else
-    g_mutex_unlock (&gftp_ssl_mutexes[n]);
-}
-
-
-unsigned long /* callback */
-_gftp_ssl_id_function (void)
-{ 
-  DEBUG_PRINT_FUNC
-  return ((unsigned long) g_thread_self ());
-} 
-
-
-struct CRYPTO_dynlock_value * /* callback */
-_gftp_ssl_create_dyn_mutex (const char *file, int line)
-{ 
-  DEBUG_PRINT_FUNC
-  struct CRYPTO_dynlock_value *value;
-
-  value = g_malloc0 (sizeof (*value));
-  g_mutex_init (&value->mutex);
-  return (value);
-}
-
-
-void /* callback */
-_gftp_ssl_dyn_mutex_lock (int mode, struct CRYPTO_dynlock_value *l,
-                          const char *file, int line)
-{
-  DEBUG_PRINT_FUNC
-  if (mode & CRYPTO_LOCK)
-    g_mutex_lock (&l->mutex);
-  else
-    g_mutex_unlock (&l->mutex);
-}
-
-
-void /* callback */
-_gftp_ssl_destroy_dyn_mutex (struct CRYPTO_dynlock_value *l,
-                             const char *file, int line)
-{
-  DEBUG_PRINT_FUNC
-  g_mutex_clear (&l->mutex);
-  g_free (l);
-}
-
-
-static void _gftp_ssl_thread_setup (void)
-{
-  DEBUG_PRINT_FUNC
-  int i;
-
-  gftp_ssl_mutexes = g_malloc0 (CRYPTO_num_locks( ) * sizeof (*gftp_ssl_mutexes));
-
-  for (i = 0; i < CRYPTO_num_locks ( ); i++)
-    g_mutex_init (&gftp_ssl_mutexes[i]);
-
-  CRYPTO_set_id_callback (_gftp_ssl_id_function);
-  CRYPTO_set_locking_callback (_gftp_ssl_locking_function);
-  CRYPTO_set_dynlock_create_callback (_gftp_ssl_create_dyn_mutex);
-  CRYPTO_set_dynlock_lock_callback (_gftp_ssl_dyn_mutex_lock);
-  CRYPTO_set_dynlock_destroy_callback (_gftp_ssl_destroy_dyn_mutex);
-} 
-
-
 static void gftp_ssl_keylog_callback(const SSL *ssl, const char *line) 
 {
   const char *gftp_keylog_file = getenv("SSLKEYLOGFILE");
@@ -351,8 +403,6 @@ int gftp_ssl_startup (gftp_request * request)
 
   gftp_ssl_initialized = 1;
 
-  _gftp_ssl_thread_setup ();
-
   if (!SSL_library_init ())
     {
       request->logging_function (gftp_logging_error, request,
@@ -388,6 +438,12 @@ int gftp_ssl_startup (gftp_request * request)
 
   SSL_CTX_set_options (ctx, SSL_OP_ALL|SSL_OP_NO_SSLv2);
 
+  /* The sessions are kept in gftp_ssl_sessions, by host instead of by the
+     session ID that OpenSSL's own cache uses */
+  SSL_CTX_set_session_cache_mode (ctx, SSL_SESS_CACHE_CLIENT |
+                                       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb (ctx, gftp_ssl_new_session_callback);
+
   if (SSL_CTX_set_cipher_list (ctx, "ALL:!ADH:!LOW:!EXP:!MD5:@STRENGTH") != 1)
     {
       request->logging_function (gftp_logging_error, request,
@@ -395,11 +451,74 @@ int gftp_ssl_startup (gftp_request * request)
       return (GFTP_EFATAL);
     }
 
-  gftp_ssl_map = g_hash_table_new_full (g_int_hash, g_int_equal, g_free, NULL);
+  gftp_ssl_sessions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify) SSL_SESSION_free);
+
+  return (0);
+}
+
+/* The sockets are non-blocking. When OpenSSL needs to read or write before
+   it can go on, this waits until fd is ready for that, for at most
+   network_timeout seconds */
+
+static int gftp_ssl_wait (gftp_request * request, int fd, int ssl_err)
+{
+  intptr_t network_timeout;
+  gint64 now, deadline;
+  struct pollfd pfd;
+  int ret, wait;
+
+  network_timeout = gftp_get_request_options (request)->network_timeout;
+  deadline = g_get_monotonic_time () + (gint64) network_timeout * G_USEC_PER_SEC;
+
+  pfd.fd = fd;
+  pfd.events = ssl_err == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN;
+  pfd.revents = 0;
+
+  /* Wake up now and then to check for cancellation, a handshake with a
+     server that went away would otherwise hold the request until the
+     network timeout (or forever without one) */
+  do
+    {
+      if (request->cancel)
+        return (GFTP_ERETRYABLE);
+
+      wait = GFTP_SSL_WAIT_SLICE;
+      if (network_timeout > 0)
+        {
+          now = g_get_monotonic_time ();
+          if (now >= deadline)
+            {
+              ret = 0;
+              break;
+            }
+          if (deadline - now < (gint64) wait * 1000)
+            wait = (deadline - now + 999) / 1000;
+        }
+
+      ret = poll (&pfd, 1, wait);
+    }
+  while ((ret < 0 && errno == EINTR) || ret == 0);
+
+  if (ret == 0)
+    {
+      request->logging_function (gftp_logging_error, request,
+                                 _("Connection to %s timed out\n"),
+                                 request->hostname);
+      return (GFTP_ERETRYABLE);
+    }
+  else if (ret < 0)
+    {
+      request->logging_function (gftp_logging_error, request,
+                                 _("Error: Could not read from socket: %s\n"),
+                                 g_strerror (errno));
+      return (GFTP_ERETRYABLE);
+    }
 
   return (0);
 }
 
+
 static void gftp_ssl_abort (gftp_request * request, int fd)
 {
   DEBUG_PRINT_FUNC
@@ -412,13 +531,16 @@ int gftp_ssl_session_setup_ex (gftp_request * request, int fd)
 {
   DEBUG_PRINT_FUNC
   intptr_t verify_ssl_peer;
+  SSL_SESSION * session;
+  gint64 starttime;
   BIO * bio;
   long ret;
-  SSL* ssl = gftp_get_ssl_for_fd (fd);
+  int err;
+  SSL* ssl;
 
   /* ensure the data socket is open and tls is not yet started on it */
   g_return_val_if_fail (fd > 0, GFTP_EFATAL);
-  g_return_val_if_fail (ssl == 0, GFTP_EFATAL);
+  g_return_val_if_fail (*gftp_ssl_for_fd (request, fd) == NULL, GFTP_EFATAL);
 
   if (!gftp_ssl_initialized)
     {
@@ -428,19 +550,6 @@ int gftp_ssl_session_setup_ex (gftp_request * request, int fd)
       return (GFTP_EFATAL);
     }
 
-  /* FIXME - take this out. I need to find out how to do timeouts with the SSL
-   * functions (a select() or poll() like function)
-   *
-   * In the meantime, set the data socket to blocking for tls negotiation
-   */
-  int non_blocking = gftp_fd_get_sockblocking (request, fd);
-  if ((non_blocking < 0) || (non_blocking == 1 &&
-                             gftp_fd_set_sockblocking(request,fd,0) < 0))
-    {
-      gftp_ssl_abort (request, fd);
-      return (GFTP_ERETRYABLE);
-    }
-
   if ((bio = BIO_new (BIO_s_socket ())) == NULL)
     {
       request->logging_function (gftp_logging_error, request,
@@ -466,17 +575,51 @@ int gftp_ssl_session_setup_ex (gftp_request * request, int fd)
    * for secondary connections, reuse the session ID from the
    * primary connection.  this is required for FTPS data connections,
    * which must reuse the control channel's session.
+   * The primary connection resumes the last session with the host.
    */
   if (fd != request->datafd)
-    SSL_set_session (ssl, SSL_get1_session (gftp_get_ssl_for_fd (request->datafd)));
+    session = SSL_get1_session (request->ssl);
+  else
+    session = gftp_ssl_get_cached_session (request);
 
-  if (SSL_connect (ssl) <= 0)
+  if (session != NULL)
     {
-      gftp_ssl_abort (request, fd);
-      return (GFTP_EFATAL);
+      SSL_set_session (ssl, session);
+      SSL_SESSION_free (session);
+    }
+
+  starttime = g_get_monotonic_time ();
+  ERR_clear_error ();
+  while ((ret = SSL_connect (ssl)) <= 0)
+    {
+      err = SSL_get_error (ssl, ret);
+      if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+        ret = gftp_ssl_wait (request, fd, err);
+      else
+        {
+          request->logging_function (gftp_logging_error, request,
+                                     _("Error: SSL handshake failed: %s\n"),
+                                     ERR_reason_error_string (ERR_peek_error ()));
+          ret = GFTP_EFATAL;
+        }
+
+      if (ret < 0)
+        {
+          /* Don't offer a session the server didn't take again */
+          if (session != NULL && fd == request->datafd)
+            gftp_ssl_forget_session (request);
+          SSL_free (ssl);
+          gftp_ssl_abort (request, fd);
+          return (ret);
+        }
     }
 
-  gftp_set_ssl_for_fd (fd, ssl);
+  *gftp_ssl_for_fd (request, fd) = ssl;
+
+  /* Data connections always resume the control session, counting them
+     would only hide how often the control sessions are resumed */
+  if (fd == request->datafd)
+    gftp_ssl_log_handshake (request, ssl, g_get_monotonic_time () - starttime);
 
   /* perform cert check only on the main (control) channel */
   if (fd == request->datafd)
@@ -490,6 +633,7 @@ int gftp_ssl_session_setup_ex (gftp_request * request, int fd)
             request->logging_function (gftp_logging_error, request,
                                        _("Error with peer certificate: %s\n"),
                                        X509_verify_cert_error_string (ret));
+          gftp_ssl_forget_session (request);
           gftp_ssl_abort (request, fd);
           return (GFTP_EFATAL);
         }
@@ -501,14 +645,6 @@ int gftp_ssl_session_setup_ex (gftp_request * request, int fd)
                              SSL_get_cipher_version (ssl), 
                              SSL_get_cipher_name (ssl));
 
-  /* restore the socket's previous blocking state */
-  if (non_blocking &&
-      (ret = gftp_fd_set_sockblocking (request, fd, 1)) < 0)
-    {
-      gftp_ssl_abort (request, fd);
-      return ret;
-    }
-
   return (0);
 }
 
@@ -523,12 +659,12 @@ gftp_ssl_session_setup (gftp_request * request)
 void gftp_ssl_session_close_ex (gftp_request * request, int fd)
 {
   DEBUG_PRINT_FUNC
-  SSL* ssl = gftp_get_ssl_for_fd (fd);
-  if(ssl)
+  SSL** ssl = gftp_ssl_for_fd (request, fd);
+  if(*ssl)
     {
-      SSL_shutdown (ssl);
-      SSL_free (ssl);
-      gftp_set_ssl_for_fd(fd, NULL);
+      SSL_shutdown (*ssl);
+      SSL_free (*ssl);
+      *ssl = NULL;
     }
 }
 
@@ -539,13 +675,24 @@ void gftp_ssl_session_close (gftp_request * request)
   gftp_ssl_session_close_ex (request, request->datafd);
 }
 
+
+/* The callbacks find the request through the SSL object. When the session
+   is handed to another request, it has to point to the new one */
+
+void gftp_ssl_set_owner (gftp_request * request)
+{
+  DEBUG_PRINT_FUNC
+  if (request->ssl != NULL)
+    SSL_set_ex_data (request->ssl, gftp_ssl_get_index (), request);
+}
+
 ssize_t 
 gftp_ssl_read (gftp_request * request, void *ptr, size_t size, int fd)
 {
   //DEBUG_PRINT_FUNC
   int ret;
   int err;
-  SSL* ssl = gftp_get_ssl_for_fd (fd);
+  SSL* ssl = *gftp_ssl_for_fd (request, fd);
 
   g_return_val_if_fail (ssl != NULL, GFTP_EFATAL);
 
@@ -556,34 +703,33 @@ gftp_ssl_read (gftp_request * request, void *ptr, size_t size, int fd)
       return (GFTP_EFATAL);
     }
 
-  errno = 0;
-  ret = 0;
   do
     {
-      if ((ret = SSL_read (ssl, ptr, size)) < 0)
-        { 
-          err = SSL_get_error (ssl, ret);
-          if (errno == EINTR || errno == EAGAIN)
-            {
-              if (request->cancel)
-                {
-                  gftp_ssl_abort (request, fd);
-                  return (GFTP_ERETRYABLE);
-                }
+      ERR_clear_error ();
+      if ((ret = SSL_read (ssl, ptr, size)) > 0)
+        break;
 
-              continue;
+      err = SSL_get_error (ssl, ret);
+      if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+        {
+          if ((ret = gftp_ssl_wait (request, fd, err)) < 0)
+            {
+              gftp_ssl_abort (request, fd);
+              return (ret);
             }
- 
-          request->logging_function (gftp_logging_error, request,
-                                   _("Error: Could not read from socket: %s\n"),
-                                    g_strerror (errno));
-          request->logging_function (gftp_logging_error, request, "SSL Error CODE: %d\n", err);
-          gftp_ssl_abort (request, fd);
 
-          return (GFTP_ERETRYABLE);
+          continue;
         }
+      else if (ret == 0)
+        break; /* The peer closed the connection */
 
-      break;
+      request->logging_function (gftp_logging_error, request,
+                                 _("Error: Could not read from socket: %s\n"),
+                                 g_strerror (errno));
+      request->logging_function (gftp_logging_error, request, "SSL Error CODE: %d\n", err);
+      gftp_ssl_abort (request, fd);
+
+      return (GFTP_ERETRYABLE);
     }
   while (1);
 
@@ -596,7 +742,7 @@ gftp_ssl_write (gftp_request * request, const char *ptr, size_t size, int fd)
 {
   //DEBUG_PRINT_FUNC
   int ret, w_ret;
-  SSL* ssl = gftp_get_ssl_for_fd (fd);
+  SSL* ssl = *gftp_ssl_for_fd (request, fd);
  
   g_return_val_if_fail (ssl != NULL, GFTP_EFATAL);
 
@@ -610,22 +756,22 @@ gftp_ssl_write (gftp_request * request, const char *ptr, size_t size, int fd)
   ret = 0;
   do
     {
+      ERR_clear_error ();
       w_ret = SSL_write (ssl, ptr, size);
       if (w_ret <= 0)
         {
           int ssl_err = SSL_get_error (ssl, w_ret);
-          if (ssl_err == SSL_ERROR_WANT_WRITE ||
-              errno == EINTR || errno == EAGAIN)
+          if (ssl_err == SSL_ERROR_WANT_READ || ssl_err == SSL_ERROR_WANT_WRITE)
             {
-              if (request != NULL && request->cancel)
+              if ((w_ret = gftp_ssl_wait (request, fd, ssl_err)) < 0)
                 {
                   gftp_ssl_abort (request, fd);
-                  return (GFTP_ERETRYABLE);
+                  return (w_ret);
                 }
 
               continue;
-             }
- 
+            }
+
           request->logging_function (gftp_logging_error, request,
                                     _("Error: Could not write to socket: %s\n"),
                                     g_strerror (errno));
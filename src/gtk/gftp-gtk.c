@@ -42,7 +42,6 @@ GHashTable * pixbuf_hash_table = NULL;
 GtkActionGroup * menus = NULL;
 GtkUIManager * factory = NULL;
 
-pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_t main_thread_id;
 GList * viewedit_processes = NULL;
 intptr_t gftp_gtk_colored_msgs = 0;
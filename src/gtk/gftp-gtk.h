@@ -175,7 +175,6 @@ extern GHashTable * pixbuf_hash_table;
 extern GtkActionGroup * menus;
 extern GtkUIManager * factory;
 
-extern pthread_mutex_t log_mutex;
 extern pthread_t main_thread_id;
 extern GList * viewedit_processes;
 
@@ -35,78 +35,56 @@ void remove_files_window (gftp_window_data * wdata)
 }
 
 
-void ftp_log (gftp_logging_level level, gftp_request * request, 
-              const char *string, ...)
+/* The messages of the transfer threads are pushed onto a lock-free list
+   (newest first) and shown by the main thread in batches: each batch is
+   one idle callback, which runs after GTK has redrawn the window, so the
+   log window gets one insert per level change instead of one per line
+   and the log file gets one fflush() per batch. A transfer thread never
+   waits for the main thread to log */
+
+static gboolean log_idle_pending = FALSE; /* Main thread only */
+static int log_file_unflushed = 0;
+
+
+static void ftp_log_to_file (gftp_logging_level level, const char *logstr)
 {
-  //DEBUG_PRINT_FUNC
-  uintptr_t max_log_window_size;
-  int upd, free_logstr;
-  gftp_log * newlog;
-  gint delsize;
-  char *logstr;
-  va_list argp;
-  size_t len;
-  GtkTextBuffer * textbuf;
-  GtkTextIter iter, iter2;
-  const char *descr = NULL;
-  char *utf8_str;
-  size_t destlen;
+  if (gftp_logfd == NULL || level == gftp_logging_misc_nolog)
+    return;
 
-  va_start (argp, string);
-  if (strcmp (string, "%s") == 0)
+  if (fwrite (logstr, strlen (logstr), 1, gftp_logfd) != 1)
     {
-      logstr = va_arg (argp, char *);
-      free_logstr = 0;
+      fclose (gftp_logfd);
+      gftp_logfd = NULL;
     }
   else
-    {
-      logstr = g_strdup_vprintf (string, argp);
-      free_logstr = 1;
-    }
-  va_end (argp);
+    log_file_unflushed = 1;
+}
 
-  if ((utf8_str = gftp_string_to_utf8 (request, logstr, &destlen)) != NULL)
-    {
-      if (free_logstr)
-        g_free (logstr);
-      else
-        free_logstr = 1;
 
-      logstr = utf8_str;
-    }
+static void ftp_log_flush_file (void)
+{
+  if (gftp_logfd == NULL || !log_file_unflushed)
+    return;
 
-  if (pthread_self () != main_thread_id)
+  log_file_unflushed = 0;
+  fflush (gftp_logfd);
+  if (ferror (gftp_logfd))
     {
-      newlog = g_malloc0 (sizeof (*newlog));
-      newlog->type = level;
-      if (free_logstr)
-        newlog->msg = logstr;
-      else
-        newlog->msg = g_strdup (logstr);
-
-      pthread_mutex_lock (&log_mutex);
-      gftp_file_transfer_logs = g_list_append (gftp_file_transfer_logs, newlog);
-      pthread_mutex_unlock (&log_mutex);
-      return;
+      fclose (gftp_logfd);
+      gftp_logfd = NULL;
     }
+}
 
-  if (gftp_logfd != NULL && level != gftp_logging_misc_nolog)
-    {
-      if (fwrite (logstr, strlen (logstr), 1, gftp_logfd) != 1)
-        {
-          fclose (gftp_logfd);
-          gftp_logfd = NULL;
-        }
-      else
-        {
-          fflush (gftp_logfd);
-          if (ferror (gftp_logfd))
-            {
-              fclose (gftp_logfd);
-              gftp_logfd = NULL;
-            }
-        }
-    }
+
+static void ftp_log_to_window (gftp_logging_level level, const char *logstr)
+{
+  uintptr_t max_log_window_size;
+  GtkTextBuffer * textbuf;
+  GtkTextIter iter, iter2;
+  const char *descr = NULL;
+  gint delsize;
+  size_t len;
+  int upd;
 
   upd = gtk_adjustment_get_upper(logwdw_vadj) - gtk_adjustment_get_page_size(logwdw_vadj)
         == gtk_adjustment_get_value(logwdw_vadj);
@@ -155,6 +133,90 @@ void ftp_log (gftp_logging_level level, gftp_request * request,
           gtk_text_buffer_delete (textbuf, &iter, &iter2);
         }
     }
+}
+
+
+static gboolean ftp_log_idle (gpointer data)
+{
+  log_idle_pending = FALSE;
+  display_cached_logs ();
+  ftp_log_flush_file ();
+  return (FALSE);
+}
+
+
+static void ftp_log_schedule (void)
+{
+  if (!log_idle_pending)
+    {
+      log_idle_pending = TRUE;
+      g_idle_add (ftp_log_idle, NULL);
+    }
+}
+
+
+void ftp_log (gftp_logging_level level, gftp_request * request, 
+              const char *string, ...)
+{
+  //DEBUG_PRINT_FUNC
+  int free_logstr;
+  gftp_log * newlog;
+  char *logstr;
+  va_list argp;
+  char *utf8_str;
+  size_t destlen;
+
+  va_start (argp, string);
+  if (strcmp (string, "%s") == 0)
+    {
+      logstr = va_arg (argp, char *);
+      free_logstr = 0;
+    }
+  else
+    {
+      logstr = g_strdup_vprintf (string, argp);
+      free_logstr = 1;
+    }
+  va_end (argp);
+
+  if ((utf8_str = gftp_string_to_utf8 (request, logstr, &destlen)) != NULL)
+    {
+      if (free_logstr)
+        g_free (logstr);
+      else
+        free_logstr = 1;
+
+      logstr = utf8_str;
+    }
+
+  if (pthread_self () != main_thread_id)
+    {
+      newlog = g_malloc (sizeof (*newlog));
+      newlog->type = level;
+      if (free_logstr)
+        newlog->msg = logstr;
+      else
+        newlog->msg = g_strdup (logstr);
+
+      do
+        newlog->next = g_atomic_pointer_get (&gftp_file_transfer_logs);
+      while (!g_atomic_pointer_compare_and_exchange (&gftp_file_transfer_logs,
+                                                     newlog->next, newlog));
+
+      /* The first message of a batch wakes up the main thread, g_idle_add()
+         may be called from any thread */
+      if (newlog->next == NULL)
+        g_idle_add (ftp_log_idle, NULL);
+      return;
+    }
+
+  /* Keep the order with the messages that are still queued */
+  if (g_atomic_pointer_get (&gftp_file_transfer_logs) != NULL)
+    display_cached_logs ();
+
+  ftp_log_to_file (level, logstr);
+  ftp_log_to_window (level, logstr);
+  ftp_log_schedule ();
 
   DEBUG_MSG(logstr)
   if (free_logstr)
@@ -789,23 +851,41 @@ YesNoDialog (GtkWindow * parent_window,              /* nullable */
 void display_cached_logs (void)
 {
   DEBUG_PRINT_FUNC
-  gftp_log * templog;
-  GList * templist; 
+  gftp_log * templog, * list, * next;
+  GString * run;
+
+  do
+    list = g_atomic_pointer_get (&gftp_file_transfer_logs);
+  while (list != NULL &&
+         !g_atomic_pointer_compare_and_exchange (&gftp_file_transfer_logs,
+                                                 list, NULL));
+
+  /* The list is newest first */
+  for (templog = list, list = NULL; templog != NULL; templog = next)
+    {
+      next = templog->next;
+      templog->next = list;
+      list = templog;
+    }
+
+  /* Consecutive messages of the same level go into the window at once */
+  run = g_string_new (NULL);
+  for (templog = list; templog != NULL; templog = next)
+    {
+      next = templog->next;
+
+      ftp_log_to_file (templog->type, templog->msg);
+      g_string_append (run, templog->msg);
+      if (next == NULL || next->type != templog->type)
+        {
+          ftp_log_to_window (templog->type, run->str);
+          g_string_truncate (run, 0);
+        }
 
-  pthread_mutex_lock (&log_mutex);
-  templist = gftp_file_transfer_logs;
-  while (templist != NULL)
-    { 
-      templog = (gftp_log *) templist->data;
-      ftp_log (templog->type, NULL, "%s", templog->msg);
       g_free (templog->msg);
       g_free (templog); 
-      templist->data = NULL;
-      templist = templist->next;
     }
-  g_list_free (gftp_file_transfer_logs);
-  gftp_file_transfer_logs = NULL;
-  pthread_mutex_unlock (&log_mutex);
+  g_string_free (run, TRUE);
 }
 
 char * get_image_path (char *filename)
@@ -784,6 +784,7 @@ static void  show_transfer (gftp_transfer * tdata)
   gftpui_common_curtrans_data * transdata;
   gftp_file * tempfle;
   GList * templist;
+  off_t total_bytes;
   char *text[2];
 #if !defined(TRANSFER_GTK_TREEVIEW)
   GdkPixmap * closedir_pixmap, * opendir_pixmap;
@@ -813,7 +814,7 @@ static void  show_transfer (gftp_transfer * tdata)
   tdata->show = 0;
   tdata->curfle = tdata->updfle = tdata->files;
 
-  tdata->total_bytes = 0;
+  total_bytes = 0;
   for (templist = tdata->files; templist != NULL; templist = templist->next)
   {
       tempfle = templist->data;
@@ -822,7 +823,7 @@ static void  show_transfer (gftp_transfer * tdata)
       if (tempfle->transfer_action == GFTP_TRANS_ACTION_SKIP) {
         text[1] = _("Skipped");
       } else {
-          tdata->total_bytes += tempfle->size;
+          total_bytes += tempfle->size;
           text[1] = _("Waiting...");
       }
 
@@ -841,6 +842,10 @@ static void  show_transfer (gftp_transfer * tdata)
 #endif
   }
 
+  gftp_transfer_stats_begin (tdata);
+  tdata->total_bytes = total_bytes;
+  gftp_transfer_stats_end (tdata);
+
   if (!tdata->toreq->stopable && gftp_need_password (tdata->toreq))
     {
       tdata->toreq->stopable = 1;
@@ -980,6 +985,7 @@ static void  create_transfer (gftp_transfer * tdata)
   num_transfers_in_progress++;
   tdata->started = 1;
   tdata->stalled = 1;
+  tdata->shown_seq = -1;
 #if !defined(TRANSFER_GTK_TREEVIEW)
   gtk_ctree_node_set_text (GTK_CTREE (dlwdw), tdata->user_data, 1,
                            _("Connecting..."));
@@ -996,31 +1002,30 @@ static void  create_transfer (gftp_transfer * tdata)
 }
 
 
-static void _setup_dlstr (gftp_transfer * tdata, gftp_file * fle,
-                          struct transfer_status *tstatus)
+static void _setup_dlstr (gftp_transfer * tdata, gftp_transfer_stats * stats,
+                          gftp_file * fle, struct transfer_status *tstatus)
 {
   DEBUG_PRINT_FUNC
   int hours, mins, secs, stalled, usesentdescr;
   unsigned long remaining_secs, lkbs;
   char gotstr[50], ofstr[50];
-  struct timeval tv;
   char *dlstr = tstatus->text;
   size_t dlstr_len = sizeof(tstatus->text);
+  size_t len;
 
   stalled = 1;
-  gettimeofday (&tv, NULL);
   usesentdescr = (tdata->fromreq->protonum == GFTP_PROTOCOL_LOCALFS);
 
   insert_commas (fle->size, ofstr, sizeof (ofstr));
-  insert_commas (tdata->curtrans + tdata->curresumed, gotstr, sizeof (gotstr));
+  insert_commas (stats->curtrans + stats->curresumed, gotstr, sizeof (gotstr));
 
-  tstatus->percent = (int) ((double) (tdata->curtrans + tdata->curresumed) / (double) fle->size * 100.0);
+  tstatus->percent = (int) ((double) (stats->curtrans + stats->curresumed) / (double) fle->size * 100.0);
 
-  if (tv.tv_sec - tdata->lasttime.tv_sec <= 5)
+  if (g_get_monotonic_time () - stats->lasttime <= 5 * G_USEC_PER_SEC)
     {
-      remaining_secs = (fle->size - tdata->curtrans - tdata->curresumed) / 1024;
+      remaining_secs = (fle->size - stats->curtrans - stats->curresumed) / 1024;
 
-      lkbs = (unsigned long) tdata->kbs;
+      lkbs = (unsigned long) stats->kbs;
       if (lkbs > 0)
         remaining_secs /= lkbs;
 
@@ -1036,19 +1041,25 @@ static void _setup_dlstr (gftp_transfer * tdata, gftp_file * fle,
           if (usesentdescr)
             {
               g_snprintf (dlstr, dlstr_len,
-                          _("Sent %s of %s at %.2fKB/s, %02d:%02d:%02d est. time remaining"), gotstr, ofstr, tdata->kbs, hours, mins, secs);
+                          _("Sent %s of %s at %.2fKB/s, %02d:%02d:%02d est. time remaining"), gotstr, ofstr, stats->kbs, hours, mins, secs);
             }
           else
             {
               g_snprintf (dlstr, dlstr_len,
-                          _("Recv %s of %s at %.2fKB/s, %02d:%02d:%02d est. time remaining"), gotstr, ofstr, tdata->kbs, hours, mins, secs);
+                          _("Recv %s of %s at %.2fKB/s, %02d:%02d:%02d est. time remaining"), gotstr, ofstr, stats->kbs, hours, mins, secs);
+            }
+
+          if (stats->blksize > 0)
+            {
+              len = strlen (dlstr);
+              g_snprintf (dlstr + len, dlstr_len - len, _(", %luKB blocks"),
+                          (unsigned long) stats->blksize / 1024);
             }
         }
     }
 
   if (stalled)
     {
-      tdata->stalled = 1;
       if (usesentdescr)
         {
           g_snprintf (dlstr, dlstr_len,
@@ -1070,21 +1081,38 @@ static void  update_file_status (gftp_transfer * tdata)
   DEBUG_PRINT_FUNC
   char totstr[150], winstr[150];
   struct transfer_status tstatus;
+  gftp_transfer_stats stats;
   unsigned long remaining_secs, lkbs;
-  int hours, mins, secs, pcent;
+  int hours, mins, secs, pcent, stalled;
   intptr_t show_trans_in_title;
   gftp_file * tempfle;
+  GList * curfle;
+  gint seq;
+
+  /* This runs without the structmutex, the transfer thread may move on to
+     the next file in the meantime */
+  if ((curfle = g_atomic_pointer_get (&tdata->curfle)) == NULL)
+    return;
+  tempfle = curfle->data;
 
   tstatus.percent = 0;
   tstatus.percent_str[0] = '\0';
   tstatus.text[0] = '\0';
 
-  g_mutex_lock (&tdata->statmutex);
-  tempfle = tdata->curfle->data;
+  seq = g_atomic_int_get (&tdata->stat_seq);
+  gftp_get_transfer_stats (tdata, &stats);
+
+  /* Only the rows of the transfers that made progress, or that just
+     stalled, are updated */
+  stalled = g_get_monotonic_time () - stats.lasttime > 5 * G_USEC_PER_SEC;
+  if (seq == tdata->shown_seq && stalled == tdata->shown_stalled)
+    return;
+  tdata->shown_seq = seq;
+  tdata->shown_stalled = stalled;
 
-  remaining_secs = (tdata->total_bytes - tdata->trans_bytes - tdata->resumed_bytes) / 1024;
+  remaining_secs = (stats.total_bytes - stats.trans_bytes - stats.resumed_bytes) / 1024;
 
-  lkbs = (unsigned long) tdata->kbs;
+  lkbs = (unsigned long) stats.kbs;
   if (lkbs > 0)
     remaining_secs /= lkbs;
 
@@ -1095,13 +1123,10 @@ static void  update_file_status (gftp_transfer * tdata)
   secs = remaining_secs;
 
   if (hours < 0 || mins < 0 || secs < 0)
-    {
-      g_mutex_unlock (&tdata->statmutex);
-      return;
-    }
+    return;
 
-  if ((double) tdata->total_bytes > 0)
-    pcent = (int) ((double) (tdata->trans_bytes + tdata->resumed_bytes) / (double) tdata->total_bytes * 100.0);
+  if ((double) stats.total_bytes > 0)
+    pcent = (int) ((double) (stats.trans_bytes + stats.resumed_bytes) / (double) stats.total_bytes * 100.0);
   else
     pcent = 0;
 
@@ -1116,9 +1141,8 @@ static void  update_file_status (gftp_transfer * tdata)
         tdata->numdirs + tdata->numfiles);
 
   if (!tdata->stalled) {
-      _setup_dlstr (tdata, tempfle, &tstatus);
+      _setup_dlstr (tdata, &stats, tempfle, &tstatus);
   }
-  g_mutex_unlock (&tdata->statmutex);
 
 #if !defined(TRANSFER_GTK_TREEVIEW)
   gtk_ctree_node_set_text (GTK_CTREE (dlwdw), tdata->user_data, 1, totstr);
@@ -1169,13 +1193,11 @@ static void  update_window_transfer_bytes (gftp_window_data * wdata)
 gint  update_downloads (gpointer data)
 {
   //DEBUG_PRINT_FUNC
-  /* endless loop 1 second */
-  intptr_t do_one_transfer_at_a_time, start_transfers;
+  /* endless loop, every transfer_refresh milliseconds */
+  intptr_t max_transfers, start_transfers, transfer_refresh;
   GList * templist, * next;
   gftp_transfer * tdata;
-
-  if (gftp_file_transfer_logs != NULL)
-    display_cached_logs ();
+  int started;
 
   if (window1.request->gotbytes != 0)
     update_window_transfer_bytes (&window1);
@@ -1207,23 +1229,31 @@ gint  update_downloads (gpointer data)
 
           if (tdata->curfle != NULL)
             {
-              gftp_lookup_global_option ("one_transfer", 
-                                         &do_one_transfer_at_a_time);
+              gftp_lookup_global_option ("max_transfers", &max_transfers);
               gftp_lookup_global_option ("start_transfers", &start_transfers);
 
+              /* The transfers that are over the limit wait in the queue,
+                 without a thread, until a running one is done */
               if (!tdata->started && start_transfers &&
-                 (num_transfers_in_progress == 0 || !do_one_transfer_at_a_time))
+                 (max_transfers <= 0 || num_transfers_in_progress < max_transfers))
                 create_transfer (tdata);
-
-              if (tdata->started)
-                update_file_status (tdata);
             }
+          started = tdata->started;
           g_mutex_unlock (&tdata->structmutex);
+
+          /* The statistics are read without a lock, formatting them
+             doesn't hold up the transfer thread */
+          if (started)
+            update_file_status (tdata);
         }
       templist = templist->next;
     }
 
-  g_timeout_add (1000, update_downloads, NULL);
+  gftp_lookup_global_option ("transfer_refresh", &transfer_refresh);
+  if (transfer_refresh < 50)
+    transfer_refresh = 50;
+
+  g_timeout_add (transfer_refresh, update_downloads, NULL);
   return (0);
 }
 
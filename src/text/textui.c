@@ -201,16 +201,24 @@ static void
 _gftpui_text_print_status (gftp_transfer * tdata)
 {
   static int progress_pos = 0;
-  char *progress = "|/-\\";
+  char *progress = "|/-\\", blkstr[32];
+  gftp_transfer_stats stats;
   unsigned int sw, tot, i;
 
+  gftp_get_transfer_stats (tdata, &stats);
+
+  if (stats.blksize > 0)
+    g_snprintf (blkstr, sizeof (blkstr), " %luK", (unsigned long) stats.blksize / 1024);
+  else
+    *blkstr = '\0';
+
   printf ("\r%c [", progress[progress_pos++]);
 
   if (progress[progress_pos] == '\0')
     progress_pos = 0;
 
-  sw = gftp_text_get_win_size () - 20;
-  tot = (unsigned int) ((float) tdata->curtrans / (float) tdata->tot_file_trans * (float) sw);
+  sw = gftp_text_get_win_size () - 20 - strlen (blkstr);
+  tot = (unsigned int) ((float) stats.curtrans / (float) stats.tot_file_trans * (float) sw);
                         
   if (tot > sw)
     tot = sw;
@@ -221,7 +229,7 @@ _gftpui_text_print_status (gftp_transfer * tdata)
   for (i = 0; i < sw - tot; i++)
     printf (" ");
 
-  printf ("] @ %.2fKB/s", tdata->kbs);
+  printf ("] @ %.2fKB/s%s", stats.kbs, blkstr);
 
   fflush (stdout);
 }
@@ -1135,7 +1135,7 @@ gftpui_common_add_file_transfer (gftp_request * fromreq, gftp_request * toreq,
                                  GList * files)
 {
   DEBUG_PRINT_FUNC
-  intptr_t append_transfers, one_transfer, overwrite_default;
+  intptr_t append_transfers, max_transfers, overwrite_default;
   GList * templist, *curfle;
   gftp_transfer * tdata;
   gftp_file * tempfle;
@@ -1143,7 +1143,7 @@ gftpui_common_add_file_transfer (gftp_request * fromreq, gftp_request * toreq,
   
   gftp_lookup_request_option (fromreq, "overwrite_default", &overwrite_default);
   gftp_lookup_request_option (fromreq, "append_transfers", &append_transfers);
-  gftp_lookup_request_option (fromreq, "one_transfer", &one_transfer);
+  gftp_lookup_request_option (fromreq, "max_transfers", &max_transfers);
 
   if (!overwrite_default)
     {
@@ -1160,7 +1160,7 @@ gftpui_common_add_file_transfer (gftp_request * fromreq, gftp_request * toreq,
     show_dialog = 0;
 
   tdata = NULL;
-  if (append_transfers && one_transfer && !show_dialog)
+  if (append_transfers && max_transfers == 1 && !show_dialog)
     {
       g_mutex_lock (&gftpui_common_transfer_mutex);
 
@@ -1193,7 +1193,11 @@ gftpui_common_add_file_transfer (gftp_request * fromreq, gftp_request * toreq,
                 tdata->numfiles++;
 
               if (tempfle->transfer_action != GFTP_TRANS_ACTION_SKIP)
-                tdata->total_bytes += tempfle->size;
+                {
+                  gftp_transfer_stats_begin (tdata);
+                  tdata->total_bytes += tempfle->size;
+                  gftp_transfer_stats_end (tdata);
+                }
 
               gftpui_add_file_to_transfer (tdata, curfle);
             }
@@ -1276,34 +1280,222 @@ _do_transfer_block (gftp_transfer * tdata, gftp_file * curfle, char *buf,
 }
 
 
+/* Bounds of the adaptive block size and how long the throughput is measured
+   before the block size is changed again */
+#define GFTPUI_MIN_BLKSIZE         4096
+#define GFTPUI_MAX_BLKSIZE         (1024 * 1024)
+#define GFTPUI_BLKSIZE_WINDOW      (G_USEC_PER_SEC / 4)
+#define GFTPUI_BLKSIZE_MAX_LATENCY (G_USEC_PER_SEC / 2)
+#define GFTPUI_BLKSIZE_PROBE       8
+
+typedef struct _gftpui_blksize
+{
+  size_t blksize;
+  int direction;       /* 1 while growing, -1 while shrinking */
+  int steady_windows;  /* Windows in a row without a change in throughput */
+  double last_rate;    /* Bytes per second of the previous window */
+  gint64 window_start;
+  gint64 max_latency;  /* Slowest block of the window */
+  off_t window_bytes;
+  int window_blocks;
+  int short_blocks;    /* Blocks of the window that the source didn't fill */
+} gftpui_blksize;
+
+
+static void
+_gftpui_common_blksize_init (gftpui_blksize * bs, size_t blksize)
+{
+  memset (bs, 0, sizeof (*bs));
+  bs->blksize = CLAMP (blksize, GFTPUI_MIN_BLKSIZE, GFTPUI_MAX_BLKSIZE);
+  bs->direction = 1;
+  bs->window_start = g_get_monotonic_time ();
+}
+
+
+/* Hill climbs towards the block size with the best throughput: keep doubling
+   or halving the block size while the throughput of a window improves, and
+   turn around when it drops. The block size doesn't grow when the source
+   can't fill the blocks or the destination socket is backed up, and shrinks
+   when a single block takes long enough to make progress updates and
+   cancelling sluggish */
+
+static void
+_gftpui_common_adapt_blksize (gftp_transfer * tdata, gftpui_blksize * bs,
+                              ssize_t num_trans, gint64 block_usecs)
+{
+  int sndbuf, queued, direction;
+  gint64 now, elapsed;
+  size_t blksize;
+  double rate;
+
+  bs->window_bytes += num_trans;
+  bs->window_blocks++;
+  if ((size_t) num_trans < bs->blksize)
+    bs->short_blocks++;
+  if (block_usecs > bs->max_latency)
+    bs->max_latency = block_usecs;
+
+  now = g_get_monotonic_time ();
+  elapsed = now - bs->window_start;
+  if (elapsed < GFTPUI_BLKSIZE_WINDOW)
+    return;
+
+  rate = (double) bs->window_bytes * G_USEC_PER_SEC / elapsed;
+  direction = 0;
+
+  if (bs->max_latency > GFTPUI_BLKSIZE_MAX_LATENCY)
+    direction = -1;
+  else if (bs->last_rate > 0 && rate < bs->last_rate * 0.95)
+    direction = -bs->direction; /* The last step made it worse */
+  else if (bs->last_rate <= 0 || rate > bs->last_rate * 1.05)
+    direction = bs->direction;
+  else if (++bs->steady_windows >= GFTPUI_BLKSIZE_PROBE)
+    direction = bs->direction;
+
+  if (direction > 0 && bs->short_blocks * 2 > bs->window_blocks)
+    direction = 0;
+
+  if (direction > 0 && tdata->toreq->datafd >= 0 &&
+      gftp_fd_get_send_queue (tdata->toreq->datafd, &sndbuf, &queued) == 0 &&
+      queued * 2 > sndbuf)
+    direction = 0;
+
+  blksize = bs->blksize;
+  if (direction > 0 && blksize < GFTPUI_MAX_BLKSIZE)
+    blksize *= 2;
+  else if (direction < 0 && blksize > GFTPUI_MIN_BLKSIZE)
+    blksize /= 2;
+  else if (direction != 0)
+    direction = -direction; /* At a bound, try the other way next time */
+
+  if (direction != 0)
+    {
+      bs->direction = direction;
+      bs->steady_windows = 0;
+    }
+
+  bs->blksize = CLAMP (blksize, GFTPUI_MIN_BLKSIZE, GFTPUI_MAX_BLKSIZE);
+  bs->last_rate = rate;
+  bs->window_start = now;
+  bs->window_bytes = 0;
+  bs->window_blocks = bs->short_blocks = 0;
+  bs->max_latency = 0;
+}
+
+
+static double
+_gftpui_common_cpu_time (void)
+{
+  struct rusage usage;
+
+#ifdef RUSAGE_THREAD
+  if (getrusage (RUSAGE_THREAD, &usage) != 0)
+#else
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+#endif
+    return (0);
+
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+          (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0);
+}
+
+
 int
 _gftpui_common_do_transfer_file (gftp_transfer * tdata, gftp_file * curfle)
 {
   DEBUG_PRINT_FUNC
-  struct timeval updatetime;
-  intptr_t trans_blksize;
-  ssize_t num_trans;
+  /* Needed for systems that size(float) < size(void *) */
+  union { intptr_t i; float f; } maxkbs;
+  intptr_t trans_blksize, adaptive_blksize;
+  gint64 updatetime, blockstart;
+  int ret, zero_copy, pipefd[2];
   char *buf;
-  int ret;
+  off_t zero_copy_bytes;
+  gftpui_blksize bs;
+  size_t bufsize;
+  double cpu_time;
+  ssize_t num_trans;
 
   gftp_lookup_request_option (tdata->fromreq, "trans_blksize", &trans_blksize);
-  buf = g_malloc0 (trans_blksize);
+  gftp_lookup_request_option (tdata->fromreq, "adaptive_blksize",
+                              &adaptive_blksize);
+  gftp_lookup_request_option (tdata->fromreq, "maxkbs", &maxkbs.f);
+
+  /* A throttled transfer is limited by maxkbs, not by the block size */
+  if (maxkbs.f > 0)
+    adaptive_blksize = 0;
+
+  if (adaptive_blksize)
+    _gftpui_common_blksize_init (&bs, trans_blksize);
+  else
+    bs.blksize = trans_blksize;
+
+  /* Plain data between the local disk and the other side is moved by the
+     kernel, unless the transfer is throttled */
+  zero_copy = maxkbs.f <= 0 && gftp_can_zero_copy (tdata->fromreq, tdata->toreq);
+  zero_copy_bytes = 0;
+  cpu_time = 0;
+  pipefd[0] = pipefd[1] = -1;
 
-  memset (&updatetime, 0, sizeof (updatetime));
+  if (zero_copy)
+    {
+      buf = NULL;
+      cpu_time = _gftpui_common_cpu_time ();
+    }
+  else
+    buf = gftp_buffer_get (bs.blksize);
+  bufsize = bs.blksize;
+
+  gftp_transfer_stats_begin (tdata);
+  tdata->blksize = adaptive_blksize ? bs.blksize : 0;
+  gftp_transfer_stats_end (tdata);
+
+  updatetime = 0;
   gftpui_start_current_file_in_transfer (tdata);
 
   num_trans = 0;
-  while (!tdata->cancel &&
-         (num_trans = _do_transfer_block (tdata, curfle, buf,
-                                          trans_blksize)) > 0)
+  while (!tdata->cancel)
     {
+      if (!zero_copy && bs.blksize > bufsize)
+        {
+          gftp_buffer_put (buf, bufsize);
+          buf = gftp_buffer_get (bs.blksize);
+          bufsize = bs.blksize;
+        }
+
+      blockstart = adaptive_blksize ? g_get_monotonic_time () : 0;
+
+      if (zero_copy)
+        num_trans = gftp_zero_copy_file_chunk (tdata->fromreq, tdata->toreq,
+                                               pipefd, bs.blksize);
+      else
+        num_trans = _do_transfer_block (tdata, curfle, buf, bs.blksize);
+
+      if (num_trans <= 0)
+        break;
+
+      if (zero_copy)
+        zero_copy_bytes += num_trans;
+
+      if (adaptive_blksize)
+        {
+          _gftpui_common_adapt_blksize (tdata, &bs, num_trans,
+                                        g_get_monotonic_time () - blockstart);
+          if (tdata->blksize != bs.blksize)
+            {
+              gftp_transfer_stats_begin (tdata);
+              tdata->blksize = bs.blksize;
+              gftp_transfer_stats_end (tdata);
+            }
+        }
+
       gftp_calc_kbs (tdata, num_trans);
 
-      if (tdata->lasttime.tv_sec - updatetime.tv_sec >= 1 ||
+      if (tdata->lasttime - updatetime >= G_USEC_PER_SEC ||
           tdata->curtrans >= tdata->tot_file_trans)
         {
           gftpui_update_current_file_in_transfer (tdata);
-          memcpy (&updatetime, &tdata->lasttime, sizeof (updatetime));
+          updatetime = tdata->lasttime;
 
           if (tdata->current_file_retries > 0)
             tdata->current_file_retries = 0;
@@ -1313,7 +1505,21 @@ _gftpui_common_do_transfer_file (gftp_transfer * tdata, gftp_file * curfle)
   if (num_trans == GFTP_ENOTRANS)
     num_trans = 0;
 
-  g_free (buf);
+  if (zero_copy)
+    {
+      if (pipefd[0] >= 0)
+        {
+          close (pipefd[0]);
+          close (pipefd[1]);
+        }
+
+      /* Logged once for the whole transfer */
+      tdata->zero_copy_bytes += zero_copy_bytes;
+      tdata->zero_copy_cpu += _gftpui_common_cpu_time () - cpu_time;
+    }
+  else
+    gftp_buffer_put (buf, bufsize);
+
   gftpui_finish_current_file_in_transfer (tdata);
 
   if ((int) num_trans == 0)
@@ -1351,7 +1557,11 @@ gftpui_common_skip_file_transfer (gftp_transfer * tdata, gftp_file * curfle)
           tdata->skip_file = 1;
         }
       else if (!curfle->transfer_done)
-        tdata->total_bytes -= curfle->size;
+        {
+          gftp_transfer_stats_begin (tdata);
+          tdata->total_bytes -= curfle->size;
+          gftp_transfer_stats_end (tdata);
+        }
     }
 
   g_mutex_unlock (&tdata->structmutex);
@@ -1396,7 +1606,9 @@ _gftpui_common_next_file_in_trans (gftp_transfer * tdata)
 
   g_mutex_lock (&tdata->structmutex);
 
+  gftp_transfer_stats_begin (tdata);
   tdata->curtrans = 0;
+  gftp_transfer_stats_end (tdata);
   tdata->next_file = 1;
 
   curfle = tdata->curfle->data;
@@ -1445,12 +1657,366 @@ _gftpui_common_preserve_perm_time (gftp_transfer * tdata, gftp_file * curfle)
 }
 
 
+typedef struct _gftpui_segment_data
+{
+  gftp_transfer * tdata;
+  gftp_file * curfle;
+  gftp_file_segment * segment;
+  gftp_request * request;
+  GThread * thread;
+  GCond * cond;     /* Signalled on tdata->structmutex when it is finished */
+  int ret;
+  unsigned int finished : 1;
+} gftpui_segment_data;
+
+
+static int
+_gftpui_common_num_segments (gftp_transfer * tdata, gftp_file * curfle)
+{
+  DEBUG_PRINT_FUNC
+  /* Needed for systems that size(float) < size(void *) */
+  union { intptr_t i; float f; } maxkbs;
+  intptr_t transfer_segments;
+  off_t remaining;
+
+  gftp_lookup_request_option (tdata->fromreq, "transfer_segments",
+                              &transfer_segments);
+  gftp_lookup_request_option (tdata->fromreq, "maxkbs", &maxkbs.f);
+
+  if (transfer_segments <= 1 || maxkbs.f > 0 ||
+      tdata->toreq->protonum != GFTP_PROTOCOL_LOCALFS)
+    return (0);
+
+  switch (tdata->fromreq->protonum)
+    {
+      case GFTP_PROTOCOL_FTP:
+      case GFTP_PROTOCOL_FTPS:
+      case GFTP_PROTOCOL_FTPSi:
+        /* The size of an ASCII transfer does not match the offsets */
+        if (ftp_is_ascii_transfer (tdata->fromreq, curfle->file))
+          return (0);
+        break;
+      case GFTP_PROTOCOL_SSH2:
+      case GFTP_PROTOCOL_HTTP:
+      case GFTP_PROTOCOL_HTTPS:
+        break;
+      default:
+        return (0);
+    }
+
+  remaining = curfle->size;
+  if (curfle->transfer_action == GFTP_TRANS_ACTION_RESUME)
+    remaining -= curfle->startsize;
+
+  if (transfer_segments > GFTPUI_MAX_TRANSFER_WORKERS)
+    transfer_segments = GFTPUI_MAX_TRANSFER_WORKERS;
+
+  if (transfer_segments > remaining / GFTPUI_MIN_SEGMENT_SIZE)
+    transfer_segments = remaining / GFTPUI_MIN_SEGMENT_SIZE;
+
+  return (transfer_segments > 1 ? transfer_segments : 0);
+}
+
+
+static void
+_gftpui_common_setup_segments (gftp_file * curfle, int num_segments)
+{
+  DEBUG_PRINT_FUNC
+  off_t startsize, seglen;
+  int i;
+
+  if (curfle->transfer_action == GFTP_TRANS_ACTION_RESUME)
+    startsize = curfle->startsize;
+  else
+    startsize = 0;
+
+  seglen = (curfle->size - startsize) / num_segments;
+
+  curfle->segments = g_malloc0 (sizeof (*curfle->segments) * num_segments);
+  curfle->num_segments = num_segments;
+
+  for (i = 0; i < num_segments; i++)
+    {
+      curfle->segments[i].start = startsize + seglen * i;
+      if (i == num_segments - 1)
+        curfle->segments[i].end = curfle->size;
+      else
+        curfle->segments[i].end = curfle->segments[i].start + seglen;
+    }
+}
+
+
+static void *
+_gftpui_common_segment_thread (void * data)
+{
+  DEBUG_PRINT_FUNC
+  gftpui_segment_data * sdata;
+  gftp_file_segment * segment;
+  ssize_t num_read, num_wrote;
+  intptr_t trans_blksize;
+  gftp_transfer * tdata;
+  gftp_request * request;
+  off_t ret;
+  size_t len;
+  char *buf;
+
+  sdata = data;
+  tdata = sdata->tdata;
+  segment = sdata->segment;
+  request = sdata->request;
+
+  gftp_lookup_request_option (request, "trans_blksize", &trans_blksize);
+  buf = gftp_buffer_get (trans_blksize);
+
+  /* Lets HTTP ask for just this range */
+  request->range_end = segment->end;
+
+  if ((ret = gftp_connect (request)) == 0 &&
+      (ret = gftp_get_file (request, sdata->curfle->file,
+                            segment->start + segment->done)) > 0)
+    ret = 0;
+
+  while (ret == 0 && !tdata->cancel &&
+         segment->start + segment->done < segment->end)
+    {
+      len = trans_blksize;
+      if ((off_t) len > segment->end - segment->start - segment->done)
+        len = segment->end - segment->start - segment->done;
+
+      if ((num_read = gftp_get_next_file_chunk (request, buf, len)) <= 0)
+        {
+          /* The server closed the file before the end of this range */
+          ret = num_read < 0 ? num_read : GFTP_ERETRYABLE;
+          break;
+        }
+
+      for (num_wrote = 0; num_wrote < num_read; num_wrote += ret)
+        {
+          ret = pwrite (tdata->toreq->datafd, buf + num_wrote,
+                        num_read - num_wrote,
+                        segment->start + segment->done + num_wrote);
+          if (ret < 0)
+            {
+              if (errno == EINTR)
+                {
+                  ret = 0;
+                  continue;
+                }
+
+              tdata->toreq->logging_function (gftp_logging_error, tdata->toreq,
+                                     _("Error: Could not write to %s: %s\n"),
+                                     sdata->curfle->destfile, g_strerror (errno));
+              break;
+            }
+        }
+
+      if (ret < 0)
+        {
+          ret = GFTP_ERETRYABLE;
+          break;
+        }
+
+      ret = 0;
+      segment->done += num_read;
+      gftp_calc_kbs (tdata, num_read);
+    }
+
+  /* The connection is kept for the segments of the next file. A range
+     that stops before the end of the file is aborted, the rest of the
+     file is not wanted */
+  if (ret < 0)
+    gftp_disconnect (request);
+  else if (segment->end < sdata->curfle->size)
+    {
+      if (gftp_abort_transfer (request) != 0)
+        gftp_disconnect (request);
+    }
+  else if (gftp_end_transfer (request) < 0)
+    gftp_disconnect (request);
+  gftp_buffer_put (buf, trans_blksize);
+
+  g_mutex_lock (&tdata->structmutex);
+  sdata->ret = ret;
+  sdata->finished = 1;
+  g_cond_signal (sdata->cond);
+  g_mutex_unlock (&tdata->structmutex);
+
+  return (NULL);
+}
+
+
+static int
+_gftpui_common_do_segmented_transfer (gftp_transfer * tdata,
+                                      gftp_file * curfle, int num_segments)
+{
+  DEBUG_PRINT_FUNC
+  gftpui_segment_data * sdata;
+  off_t truncate_size, resumed;
+  unsigned int i, running;
+  gint64 end_time;
+  GCond cond;
+  int ret;
+
+  if (curfle->segments == NULL)
+    {
+      _gftpui_common_setup_segments (curfle, num_segments);
+      truncate_size = curfle->segments[0].start;
+    }
+  else
+    truncate_size = -1;
+
+  if ((ret = localfs_open_segmented_file (tdata->toreq, curfle->destfile,
+                                          truncate_size)) < 0)
+    return (ret);
+
+  resumed = curfle->size;
+  for (i = 0; i < curfle->num_segments; i++)
+    resumed -= curfle->segments[i].end - curfle->segments[i].start -
+               curfle->segments[i].done;
+
+  gftp_transfer_stats_begin (tdata);
+
+  tdata->tot_file_trans = curfle->size;
+  tdata->curtrans = 0;
+  tdata->curresumed = resumed;
+  tdata->resumed_bytes += tdata->curresumed;
+
+  gftp_transfer_stats_end (tdata);
+
+  tdata->fromreq->logging_function (gftp_logging_misc, tdata->fromreq,
+                                    _("Transferring %s in %u segments\n"),
+                                    curfle->file, curfle->num_segments);
+
+  gftpui_start_current_file_in_transfer (tdata);
+
+  /* The connections of the segments are kept for the next file */
+  if (tdata->num_segment_reqs < (int) curfle->num_segments)
+    {
+      tdata->segment_reqs = g_realloc (tdata->segment_reqs,
+                                       sizeof (*tdata->segment_reqs) *
+                                       curfle->num_segments);
+      memset (tdata->segment_reqs + tdata->num_segment_reqs, 0,
+              sizeof (*tdata->segment_reqs) *
+              (curfle->num_segments - tdata->num_segment_reqs));
+      tdata->num_segment_reqs = curfle->num_segments;
+    }
+
+  g_cond_init (&cond);
+  sdata = g_malloc0 (sizeof (*sdata) * curfle->num_segments);
+  for (i = 0; i < curfle->num_segments; i++)
+    {
+      sdata[i].tdata = tdata;
+      sdata[i].curfle = curfle;
+      sdata[i].segment = &curfle->segments[i];
+      sdata[i].cond = &cond;
+
+      if (curfle->segments[i].start + curfle->segments[i].done >=
+          curfle->segments[i].end)
+        sdata[i].finished = 1;
+      else if (tdata->segment_reqs[i] == NULL &&
+               (tdata->segment_reqs[i] = gftp_copy_request (tdata->fromreq)) == NULL)
+        {
+          sdata[i].ret = GFTP_ERETRYABLE;
+          sdata[i].finished = 1;
+        }
+      else
+        {
+          sdata[i].request = tdata->segment_reqs[i];
+          sdata[i].request->cancel = 0;
+          sdata[i].thread = g_thread_new ("gftp-segment",
+                                          _gftpui_common_segment_thread,
+                                          &sdata[i]);
+        }
+    }
+
+  /* The segments use their own connections, so a cancel of the transfer
+     has to be passed on to them. The progress is shown a few times a
+     second, and the wait ends as soon as the last segment is done */
+  g_mutex_lock (&tdata->structmutex);
+  while (1)
+    {
+      for (i = 0, running = 0; i < curfle->num_segments; i++)
+        {
+          if (sdata[i].finished)
+            continue;
+
+          running++;
+          if (tdata->cancel)
+            sdata[i].request->cancel = 1;
+        }
+
+      if (running == 0)
+        break;
+
+      end_time = g_get_monotonic_time () + G_USEC_PER_SEC / 4;
+      g_cond_wait_until (&cond, &tdata->structmutex, end_time);
+
+      g_mutex_unlock (&tdata->structmutex);
+      gftpui_update_current_file_in_transfer (tdata);
+      g_mutex_lock (&tdata->structmutex);
+    }
+  g_mutex_unlock (&tdata->structmutex);
+
+  ret = 0;
+  for (i = 0; i < curfle->num_segments; i++)
+    {
+      if (sdata[i].thread != NULL)
+        g_thread_join (sdata[i].thread);
+
+      if (sdata[i].ret == GFTP_ENORANGE)
+        ret = GFTP_ENORANGE;
+      else if (ret == 0 && sdata[i].ret < 0)
+        ret = sdata[i].ret;
+      else if (ret == 0 && curfle->segments[i].start +
+               curfle->segments[i].done < curfle->segments[i].end)
+        ret = GFTP_ERETRYABLE;
+    }
+
+  g_free (sdata);
+  g_cond_clear (&cond);
+  gftpui_finish_current_file_in_transfer (tdata);
+
+  gftp_end_transfer (tdata->toreq);
+
+  if (ret == GFTP_ENORANGE)
+    {
+      /* The whole file is transferred again in one piece */
+      tdata->fromreq->logging_function (gftp_logging_misc, tdata->fromreq,
+                                        _("The server does not support byte ranges, transferring %s in one piece\n"),
+                                        curfle->file);
+
+      gftp_transfer_stats_begin (tdata);
+      tdata->resumed_bytes -= tdata->curresumed;
+      tdata->curresumed = 0;
+      tdata->curtrans = 0;
+      gftp_transfer_stats_end (tdata);
+    }
+
+  if (ret < 0 && ret != GFTP_ENORANGE)
+    return (ret);
+
+  g_free (curfle->segments);
+  curfle->segments = NULL;
+  curfle->num_segments = 0;
+
+  if (ret < 0)
+    return (ret);
+
+  tdata->fromreq->logging_function (gftp_logging_misc, tdata->fromreq,
+                                    _("Successfully transferred %s at %.2f KB/s\n"),
+                                    curfle->file, tdata->kbs);
+
+  return (0);
+}
+
+
 static int
 _gftpui_common_trans_file_or_dir (gftp_transfer * tdata)
 {
   DEBUG_PRINT_FUNC
+  int ret, num_segments;
+  off_t tot_file_trans;
   gftp_file * curfle;
-  int ret;
 
   g_mutex_lock (&tdata->structmutex);
 
@@ -1461,7 +2027,9 @@ _gftpui_common_trans_file_or_dir (gftp_transfer * tdata)
 
   if (curfle->transfer_action == GFTP_TRANS_ACTION_SKIP)
     {
+      gftp_transfer_stats_begin (tdata);
       tdata->tot_file_trans = 0;
+      gftp_transfer_stats_end (tdata);
       return (0);
     }
 
@@ -1473,7 +2041,9 @@ _gftpui_common_trans_file_or_dir (gftp_transfer * tdata)
 
   if (S_ISDIR (curfle->st_mode))
     {
+      gftp_transfer_stats_begin (tdata);
       tdata->tot_file_trans = 0;
+      gftp_transfer_stats_end (tdata);
       if (curfle->startsize > 0)
         ret = 1;
       else
@@ -1488,10 +2058,12 @@ _gftpui_common_trans_file_or_dir (gftp_transfer * tdata)
             DEBUG_MSG("filesize < 0!!!!!!!!!!\n\n")
             return ((int) curfle->size);
           }
+          gftp_transfer_stats_begin (tdata);
           tdata->total_bytes += curfle->size;
+          gftp_transfer_stats_end (tdata);
         }
 
-      if (curfle->retry_transfer)
+      if (curfle->retry_transfer && curfle->segments == NULL)
         {
           curfle->transfer_action = GFTP_TRANS_ACTION_RESUME;
           curfle->startsize = gftp_get_file_size (tdata->toreq, curfle->destfile);
@@ -1501,25 +2073,40 @@ _gftpui_common_trans_file_or_dir (gftp_transfer * tdata)
           }
         }
 
-      tdata->tot_file_trans = gftp_transfer_file (tdata->fromreq, curfle->file,
-                                                  curfle->transfer_action == GFTP_TRANS_ACTION_RESUME ?
-                                                          curfle->startsize : 0,
-                                                  tdata->toreq, curfle->destfile,
-                                                  curfle->transfer_action == GFTP_TRANS_ACTION_RESUME ?
-                                                          curfle->startsize : 0);
-      if (tdata->tot_file_trans < 0)
-        ret = tdata->tot_file_trans;
+      if (curfle->segments != NULL)
+        num_segments = curfle->num_segments;
       else
+        num_segments = _gftpui_common_num_segments (tdata, curfle);
+
+      if (num_segments > 0)
+        ret = _gftpui_common_do_segmented_transfer (tdata, curfle,
+                                                    num_segments);
+
+      if (num_segments == 0 || ret == GFTP_ENORANGE)
         {
-          g_mutex_lock (&tdata->structmutex);
+          tot_file_trans = gftp_transfer_file (tdata->fromreq, curfle->file,
+                                               curfle->transfer_action == GFTP_TRANS_ACTION_RESUME ?
+                                                       curfle->startsize : 0,
+                                               tdata->toreq, curfle->destfile,
+                                               curfle->transfer_action == GFTP_TRANS_ACTION_RESUME ?
+                                                       curfle->startsize : 0);
+          if (tot_file_trans < 0)
+            ret = tot_file_trans;
+          else
+            {
+              g_mutex_lock (&tdata->structmutex);
+              gftp_transfer_stats_begin (tdata);
 
-          tdata->curtrans = 0;
-          tdata->curresumed = curfle->transfer_action == GFTP_TRANS_ACTION_RESUME ? curfle->startsize : 0;
-          tdata->resumed_bytes += tdata->curresumed;
+              tdata->tot_file_trans = tot_file_trans;
+              tdata->curtrans = 0;
+              tdata->curresumed = curfle->transfer_action == GFTP_TRANS_ACTION_RESUME ? curfle->startsize : 0;
+              tdata->resumed_bytes += tdata->curresumed;
 
-          g_mutex_unlock (&tdata->structmutex);
+              gftp_transfer_stats_end (tdata);
+              g_mutex_unlock (&tdata->structmutex);
 
-          ret = _gftpui_common_do_transfer_file (tdata, curfle);
+              ret = _gftpui_common_do_transfer_file (tdata, curfle);
+            }
         }
     }
 
@@ -1537,17 +2124,427 @@ _gftpui_common_trans_file_or_dir (gftp_transfer * tdata)
 }
 
 
-int
-gftpui_common_transfer_files (gftp_transfer * tdata)
+typedef struct _gftpui_transfer_pool
+{
+  gftp_transfer * tdata;      /* The transfer the UI knows about */
+  gftp_transfer ** workers;   /* One per connection, sharing tdata->files */
+  GThread ** threads;
+  int num_workers,
+      num_running,            /* Workers that have not exited yet */
+      num_busy,               /* Workers that are transferring an entry */
+      skipped_files;
+  off_t worker_total_bytes;   /* Sum of the workers' total_bytes adjustments */
+  GCond cond;                 /* Signalled on tdata->structmutex when a worker
+                                 finishes a file or exits, or on stop */
+  unsigned int dir_busy : 1;
+  unsigned int stop : 1;
+} gftpui_transfer_pool;
+
+
+static GList *
+_gftpui_common_pool_next_file (gftpui_transfer_pool * pool)
 {
   DEBUG_PRINT_FUNC
-  int ret, skipped_files;
+  gftp_transfer * tdata;
+  gftp_file * tempfle;
+  GList * templist;
 
-  tdata->curfle = tdata->files;
-  gftpui_common_num_child_threads++;
+  tdata = pool->tdata;
+  tempfle = NULL;
+
+  g_mutex_lock (&tdata->structmutex);
+
+  while (!pool->stop)
+    {
+      for (templist = tdata->curfle; templist != NULL; templist = templist->next)
+        {
+          tempfle = templist->data;
+          if (!tempfle->transfer_done && !tempfle->transfer_queued)
+            break;
+        }
+
+      if (templist == NULL)
+        break;
+
+      /* A directory has to be created before anything inside of it is
+         transferred, so directories are only handed out when the other
+         workers are idle */
+      if (!pool->dir_busy &&
+          (!S_ISDIR (tempfle->st_mode) || pool->num_busy == 0))
+        {
+          tempfle->transfer_queued = 1;
+          if (S_ISDIR (tempfle->st_mode))
+            pool->dir_busy = 1;
+
+          pool->num_busy++;
+          tdata->current_file_number++;
+
+          g_mutex_unlock (&tdata->structmutex);
+          return (templist);
+        }
+
+      g_cond_wait (&pool->cond, &tdata->structmutex);
+    }
+
+  g_mutex_unlock (&tdata->structmutex);
+  return (NULL);
+}
+
+
+static void
+_gftpui_common_pool_file_done (gftpui_transfer_pool * pool,
+                               gftp_transfer * worker, GList * curfle,
+                               int skipped, int failed)
+{
+  DEBUG_PRINT_FUNC
+  gftp_transfer * tdata;
+  gftp_file * tempfle;
+
+  tdata = pool->tdata;
+  tempfle = curfle->data;
+
+  g_mutex_lock (&tdata->structmutex);
+
+  if (!failed)
+    tempfle->transfer_done = 1;
+  else
+    pool->stop = 1;
+
+  if (skipped)
+    pool->skipped_files++;
+
+  if (S_ISDIR (tempfle->st_mode))
+    pool->dir_busy = 0;
+  pool->num_busy--;
+
+  /* tdata->curfle is the first entry that is not finished yet. Everything
+     before it is shown as finished by the UI */
+  while (tdata->curfle != NULL &&
+         ((gftp_file *) tdata->curfle->data)->transfer_done)
+    {
+      tdata->curfle = tdata->curfle->next;
+      tdata->next_file = 1;
+    }
+
+  g_cond_broadcast (&pool->cond);
+  g_mutex_unlock (&tdata->structmutex);
+
+  g_mutex_lock (&worker->structmutex);
+  worker->curfle = NULL;
+  g_mutex_unlock (&worker->structmutex);
+
+  gftp_transfer_stats_begin (worker);
+  worker->curtrans = 0;
+  worker->curresumed = 0;
+  worker->tot_file_trans = 0;
+  gftp_transfer_stats_end (worker);
+}
+
+
+static void *
+_gftpui_common_pool_worker (void * data)
+{
+  DEBUG_PRINT_FUNC
+  gftpui_transfer_pool * pool;
+  int ret, skipped, failed;
+  gftp_transfer * tdata;
+  GList * curfle;
+
+  tdata = data;
+  pool = tdata->user_data;
+
+  failed = 0;
+  while (!failed && (curfle = _gftpui_common_pool_next_file (pool)) != NULL)
+    {
+      g_mutex_lock (&tdata->structmutex);
+      tdata->curfle = curfle;
+      tdata->current_file_retries = 0;
+      g_mutex_unlock (&tdata->structmutex);
+
+      skipped = 0;
+      while (1)
+        {
+          ret = _gftpui_common_trans_file_or_dir (tdata);
+          if (tdata->cancel)
+            {
+              if (gftp_abort_transfer (tdata->toreq) != 0)
+                gftp_disconnect (tdata->toreq);
+
+              if (gftp_abort_transfer (tdata->fromreq) != 0)
+                gftp_disconnect (tdata->fromreq);
+            }
+          else if (ret == GFTP_EFATAL || ret == GFTP_ECANIGNORE)
+            skipped = 1;
+          else if (ret < 0)
+            {
+              if (gftp_get_transfer_status (tdata, ret) != GFTP_ERETRYABLE)
+                failed = 1;
+              else if (tdata->curfle == curfle)
+                continue;
+              /* else the file was skipped while reconnecting */
+            }
+
+          break;
+        }
+
+      _gftpui_common_pool_file_done (pool, tdata, curfle, skipped, failed);
+
+      if (tdata->cancel)
+        {
+          if (!tdata->skip_file)
+            break;
+
+          g_mutex_lock (&tdata->structmutex);
+          tdata->cancel = 0;
+          tdata->skip_file = 0;
+          tdata->fromreq->cancel = 0;
+          tdata->toreq->cancel = 0;
+          g_mutex_unlock (&tdata->structmutex);
+        }
+    }
+
+  g_mutex_lock (&pool->tdata->structmutex);
+  pool->num_running--;
+  g_cond_broadcast (&pool->cond);
+  g_mutex_unlock (&pool->tdata->structmutex);
+
+  return (NULL);
+}
 
-  gettimeofday (&tdata->starttime, NULL);
-  memcpy (&tdata->lasttime, &tdata->starttime, sizeof (tdata->lasttime));
+
+static void
+_gftpui_common_pool_cancel_worker (gftp_transfer * worker, int skip_file)
+{
+  DEBUG_PRINT_FUNC
+  worker->cancel = 1;
+  worker->skip_file = skip_file;
+  worker->fromreq->cancel = 1;
+  worker->toreq->cancel = 1;
+}
+
+
+static void
+_gftpui_common_pool_update (gftpui_transfer_pool * pool)
+{
+  DEBUG_PRINT_FUNC
+  off_t trans_bytes, resumed_bytes, total_bytes, curtrans, curresumed,
+        tot_file_trans;
+  gftp_transfer * tdata, * worker;
+  gftp_transfer_stats stats;
+  gint64 lasttime, elapsed;
+  gftp_file * tempfle;
+  int i, stop;
+
+  tdata = pool->tdata;
+  trans_bytes = resumed_bytes = total_bytes = 0;
+  curtrans = curresumed = tot_file_trans = 0;
+  lasttime = 0;
+
+  g_mutex_lock (&tdata->structmutex);
+
+  /* A skip request for the first unfinished file cancels the whole
+     transfer. Hand it to the worker that has the file instead */
+  stop = tdata->cancel && !tdata->skip_file;
+  if (tdata->cancel && tdata->skip_file)
+    {
+      tdata->cancel = 0;
+      tdata->skip_file = 0;
+      tdata->fromreq->cancel = 0;
+      tdata->toreq->cancel = 0;
+    }
+
+  if (stop)
+    {
+      pool->stop = 1;
+      g_cond_broadcast (&pool->cond);
+    }
+
+  for (i = 0; i < pool->num_workers; i++)
+    {
+      worker = pool->workers[i];
+
+      g_mutex_lock (&worker->structmutex);
+
+      if (worker->curfle != NULL && !worker->cancel)
+        {
+          /* A skipped file is cancelled even before any of it has been
+             transferred, the worker may still be connecting */
+          tempfle = worker->curfle->data;
+          if (stop)
+            _gftpui_common_pool_cancel_worker (worker, 0);
+          else if (tempfle->transfer_action == GFTP_TRANS_ACTION_SKIP)
+            _gftpui_common_pool_cancel_worker (worker, 1);
+        }
+
+      gftp_get_transfer_stats (worker, &stats);
+
+      trans_bytes += stats.trans_bytes;
+      resumed_bytes += stats.resumed_bytes;
+      total_bytes += stats.total_bytes;
+
+      if (worker->curfle != NULL && worker->curfle == tdata->curfle)
+        {
+          curtrans = stats.curtrans;
+          curresumed = stats.curresumed;
+          tot_file_trans = stats.tot_file_trans;
+        }
+
+      if (stats.lasttime > lasttime)
+        lasttime = stats.lasttime;
+
+      g_mutex_unlock (&worker->structmutex);
+    }
+
+  gftp_transfer_stats_begin (tdata);
+
+  if (trans_bytes != tdata->trans_bytes)
+    tdata->stalled = 0;
+
+  tdata->trans_bytes = trans_bytes;
+  tdata->resumed_bytes = resumed_bytes;
+  tdata->total_bytes += total_bytes - pool->worker_total_bytes;
+  pool->worker_total_bytes = total_bytes;
+
+  tdata->curtrans = curtrans;
+  tdata->curresumed = curresumed;
+  tdata->tot_file_trans = tot_file_trans;
+
+  elapsed = g_get_monotonic_time () - tdata->starttime;
+  if (elapsed <= 0)
+    tdata->kbs = tdata->trans_bytes / 1024.0;
+  else
+    tdata->kbs = tdata->trans_bytes / 1024.0 / ((double) elapsed / G_USEC_PER_SEC);
+
+  if (lasttime > tdata->lasttime)
+    tdata->lasttime = lasttime;
+
+  gftp_transfer_stats_end (tdata);
+  g_mutex_unlock (&tdata->structmutex);
+}
+
+
+static gftpui_transfer_pool *
+_gftpui_common_pool_new (gftp_transfer * tdata)
+{
+  DEBUG_PRINT_FUNC
+  /* Needed for systems that size(float) < size(void *) */
+  union { intptr_t i; float f; } maxkbs;
+  gftpui_transfer_pool * pool;
+  intptr_t transfer_workers;
+  gftp_transfer * worker;
+  guint num_entries;
+
+  gftp_lookup_request_option (tdata->fromreq, "transfer_workers",
+                              &transfer_workers);
+  gftp_lookup_request_option (tdata->fromreq, "maxkbs", &maxkbs.f);
+
+  /* The bandwidth limit is enforced per connection, so limited transfers
+     stay on a single connection */
+  if (transfer_workers <= 1 || maxkbs.f > 0)
+    return (NULL);
+
+  if (transfer_workers > GFTPUI_MAX_TRANSFER_WORKERS)
+    transfer_workers = GFTPUI_MAX_TRANSFER_WORKERS;
+
+  num_entries = g_list_length (tdata->files);
+  if (num_entries <= 1)
+    return (NULL);
+  else if (transfer_workers > num_entries)
+    transfer_workers = num_entries;
+
+  pool = g_malloc0 (sizeof (*pool));
+  pool->tdata = tdata;
+  pool->workers = g_malloc0 (sizeof (*pool->workers) * transfer_workers);
+  pool->threads = g_malloc0 (sizeof (*pool->threads) * transfer_workers);
+  g_cond_init (&pool->cond);
+
+  while (pool->num_workers < transfer_workers)
+    {
+      worker = gftp_tdata_new ();
+      if ((worker->fromreq = gftp_copy_request (tdata->fromreq)) == NULL ||
+          (worker->toreq = gftp_copy_request (tdata->toreq)) == NULL)
+        {
+          free_tdata (worker);
+          break;
+        }
+
+      worker->user_data = pool;
+      worker->starttime = tdata->starttime;
+      worker->lasttime = tdata->lasttime;
+
+      pool->workers[pool->num_workers++] = worker;
+    }
+
+  if (pool->num_workers > 1)
+    return (pool);
+
+  while (pool->num_workers > 0)
+    free_tdata (pool->workers[--pool->num_workers]);
+
+  g_cond_clear (&pool->cond);
+  g_free (pool->workers);
+  g_free (pool->threads);
+  g_free (pool);
+  return (NULL);
+}
+
+
+static int
+_gftpui_common_pool_run (gftpui_transfer_pool * pool)
+{
+  DEBUG_PRINT_FUNC
+  int i, skipped_files;
+  gint64 end_time;
+
+  pool->tdata->fromreq->logging_function (gftp_logging_misc,
+                                          pool->tdata->fromreq,
+                                          _("Transferring files over %d connections\n"),
+                                          pool->num_workers);
+
+  pool->num_running = pool->num_workers;
+  for (i = 0; i < pool->num_workers; i++)
+    pool->threads[i] = g_thread_new ("gftp-transfer",
+                                     _gftpui_common_pool_worker,
+                                     pool->workers[i]);
+
+  /* The statistics are gathered a few times a second, and right away
+     when a worker finishes a file or exits */
+  g_mutex_lock (&pool->tdata->structmutex);
+  while (pool->num_running > 0)
+    {
+      end_time = g_get_monotonic_time () + G_USEC_PER_SEC / 4;
+      g_cond_wait_until (&pool->cond, &pool->tdata->structmutex, end_time);
+
+      g_mutex_unlock (&pool->tdata->structmutex);
+      _gftpui_common_pool_update (pool);
+      g_mutex_lock (&pool->tdata->structmutex);
+    }
+  g_mutex_unlock (&pool->tdata->structmutex);
+
+  for (i = 0; i < pool->num_workers; i++)
+    {
+      g_thread_join (pool->threads[i]);
+      pool->tdata->zero_copy_bytes += pool->workers[i]->zero_copy_bytes;
+      pool->tdata->zero_copy_cpu += pool->workers[i]->zero_copy_cpu;
+      free_tdata (pool->workers[i]);
+    }
+
+  skipped_files = pool->skipped_files;
+
+  g_cond_clear (&pool->cond);
+  g_free (pool->workers);
+  g_free (pool->threads);
+  g_free (pool);
+
+  return (skipped_files);
+}
+
+
+static int
+_gftpui_common_transfer_files_serial (gftp_transfer * tdata)
+{
+  DEBUG_PRINT_FUNC
+  int ret, skipped_files;
 
   skipped_files = 0;
   while (tdata->curfle != NULL)
@@ -1584,11 +2581,54 @@ gftpui_common_transfer_files (gftp_transfer * tdata)
         }
     }
 
+  return (skipped_files);
+}
+
+
+int
+gftpui_common_transfer_files (gftp_transfer * tdata)
+{
+  DEBUG_PRINT_FUNC
+  gftpui_transfer_pool * pool;
+  char movedstr[50];
+  int skipped_files;
+
+  tdata->curfle = tdata->files;
+  gftpui_common_num_child_threads++;
+
+  gftp_transfer_stats_begin (tdata);
+  tdata->starttime = g_get_monotonic_time ();
+  tdata->lasttime = tdata->starttime;
+  gftp_transfer_stats_end (tdata);
+
+  if ((pool = _gftpui_common_pool_new (tdata)) != NULL)
+    skipped_files = _gftpui_common_pool_run (pool);
+  else
+    skipped_files = _gftpui_common_transfer_files_serial (tdata);
+
   if (skipped_files)
     tdata->fromreq->logging_function (gftp_logging_error, tdata->fromreq,
                                       _("There were %d files or directories that could not be transferred. Check the log for which items were not properly transferred.\n"),
                                       skipped_files);
 
+  if (tdata->zero_copy_bytes > 0)
+    {
+      insert_commas (tdata->zero_copy_bytes, movedstr, sizeof (movedstr));
+      tdata->fromreq->logging_function (gftp_logging_misc, tdata->fromreq,
+                                        _("Moved %s bytes in the kernel, using %.2f seconds of CPU time\n"),
+                                        movedstr, tdata->zero_copy_cpu);
+    }
+
+#ifdef GFTP_DEBUG
+  {
+    gftp_buffer_pool_stats bufstats;
+
+    gftp_get_buffer_pool_stats (&bufstats);
+    DEBUG_TRACE ("Transfer buffers: %u allocated, %u reused, %u released\n",
+                 bufstats.allocated, bufstats.reused, bufstats.released)
+  }
+#endif
+
   tdata->done = 1;
   gftpui_common_num_child_threads--;
 
@@ -77,6 +77,9 @@ typedef struct _gftpui_common_curtrans_data
 
 #define gftpui_common_use_threads(request)	(gftp_protocols[(request)->protonum].use_threads)
 
+#define GFTPUI_MAX_TRANSFER_WORKERS	32
+#define GFTPUI_MIN_SEGMENT_SIZE		(4 * 1024 * 1024)
+
 extern sigjmp_buf gftpui_common_jmp_environment;
 extern volatile int gftpui_common_use_jmp_environment;
 extern gftpui_common_methods gftpui_common_commands[];
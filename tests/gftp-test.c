@@ -0,0 +1,117 @@
+/***********************************************************************************/
+/*  gftp-test.c - helpers for the tests of libgftp                                 */
+/*  Copyright (C) 1998-2007 Brian Masney <masneyb@gftp.org>                        */
+/*                                                                                 */
+/*  Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/*  of this software and associated documentation files (the "Software"), to deal  */
+/*  in the Software without restriction, including without limitation the rights   */
+/*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/*  copies of the Software, and to permit persons to whom the Software is          */
+/*  furnished to do so, subject to the following conditions:                       */
+/*                                                                                 */
+/*  The above copyright notice and this permission notice shall be included in all */
+/*  copies or substantial portions of the Software.                                */
+/*                                                                                 */
+/*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/*  SOFTWARE.                                                                      */
+/***********************************************************************************/
+
+#include "gftp-test.h"
+
+static int gftp_test_failures = 0;
+
+
+void
+gftp_test_report (int ok, const char *expr, const char *file, int line)
+{
+  if (ok)
+    return;
+
+  fprintf (stderr, "%s:%d: check failed: %s\n", file, line, expr);
+  gftp_test_failures++;
+}
+
+
+int
+gftp_test_result (void)
+{
+  if (gftp_test_failures == 0)
+    return (EXIT_SUCCESS);
+
+  fprintf (stderr, "%d checks failed\n", gftp_test_failures);
+  return (EXIT_FAILURE);
+}
+
+
+void
+gftp_test_logging (gftp_logging_level level, gftp_request * request,
+                   const char *string, ...)
+{
+  va_list argp;
+
+  va_start (argp, string);
+  vfprintf (stderr, string, argp);
+  va_end (argp);
+}
+
+
+/* Sets up the options the way gftp_read_config_file() does, without a
+   config file */
+void
+gftp_test_init_options (void)
+{
+  int i;
+
+  if (gftp_global_options_htable != NULL)
+    return;
+
+  gftp_global_options_htable = g_hash_table_new (string_hash_function,
+                                                 string_hash_compare);
+  gftp_register_config_vars (gftp_global_config_vars);
+
+  for (i = 0; gftp_protocols[i].register_options != NULL; i++)
+    gftp_protocols[i].register_options ();
+
+  gftp_config_list_htable = g_hash_table_new (string_hash_function,
+                                              string_hash_compare);
+}
+
+
+gftp_request *
+gftp_test_request_new (void)
+{
+  gftp_request * request;
+
+  request = gftp_request_new ();
+  request->logging_function = gftp_test_logging;
+  return (request);
+}
+
+
+/* The UI functions libgftp expects, nobody answers during the tests */
+
+int
+gftpui_protocol_ask_yes_no (gftp_request * request, char *title,
+                            char *question)
+{
+  return (0);
+}
+
+
+char *
+gftpui_protocol_ask_user_input (gftp_request * request, char *title,
+                                char *question, int shown)
+{
+  return (NULL);
+}
+
+
+void
+gftpui_protocol_update_timeout (gftp_request * request)
+{
+}
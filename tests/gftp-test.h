@@ -0,0 +1,45 @@
+/***********************************************************************************/
+/*  gftp-test.h - helpers for the tests of libgftp                                 */
+/*  Copyright (C) 1998-2007 Brian Masney <masneyb@gftp.org>                        */
+/*                                                                                 */
+/*  Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/*  of this software and associated documentation files (the "Software"), to deal  */
+/*  in the Software without restriction, including without limitation the rights   */
+/*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/*  copies of the Software, and to permit persons to whom the Software is          */
+/*  furnished to do so, subject to the following conditions:                       */
+/*                                                                                 */
+/*  The above copyright notice and this permission notice shall be included in all */
+/*  copies or substantial portions of the Software.                                */
+/*                                                                                 */
+/*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/*  SOFTWARE.                                                                      */
+/***********************************************************************************/
+
+#ifndef __GFTP_TEST_H
+#define __GFTP_TEST_H
+
+#include "../lib/gftp.h"
+
+/* Reports expr when it is false. The test fails at the end, after all of
+   the checks have run */
+#define gftp_test_check(expr) \
+  gftp_test_report ((expr) != 0, #expr, __FILE__, __LINE__)
+
+void gftp_test_report         (int ok,
+                               const char *expr,
+                               const char *file,
+                               int line);
+int gftp_test_result          (void);
+void gftp_test_logging        (gftp_logging_level level,
+                               gftp_request * request,
+                               const char *string, ...);
+void gftp_test_init_options   (void);
+gftp_request * gftp_test_request_new (void);
+
+#endif
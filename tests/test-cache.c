@@ -0,0 +1,214 @@
+/***********************************************************************************/
+/*  test-cache.c - tests for the directory cache                                   */
+/*  Copyright (C) 1998-2007 Brian Masney <masneyb@gftp.org>                        */
+/*                                                                                 */
+/*  Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/*  of this software and associated documentation files (the "Software"), to deal  */
+/*  in the Software without restriction, including without limitation the rights   */
+/*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/*  copies of the Software, and to permit persons to whom the Software is          */
+/*  furnished to do so, subject to the following conditions:                       */
+/*                                                                                 */
+/*  The above copyright notice and this permission notice shall be included in all */
+/*  copies or substantial portions of the Software.                                */
+/*                                                                                 */
+/*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/*  SOFTWARE.                                                                      */
+/***********************************************************************************/
+
+#include "gftp-test.h"
+
+static gftp_request *
+new_cache_request (const char *directory)
+{
+  gftp_request * request;
+
+  request = gftp_test_request_new ();
+  request->url_prefix = "ftp";
+  request->hostname = g_strdup ("ftp.example.org");
+  request->username = g_strdup ("anonymous");
+  request->port = 21;
+  request->directory = g_strdup (directory);
+  return (request);
+}
+
+
+/* Writes a listing the way gftp_get_next_file() and gftp_end_transfer()
+   do */
+static void
+write_listing (gftp_request * request, gftp_file * files, int num_files,
+               int commit)
+{
+  int i;
+
+  request->cachefd = gftp_new_cache_entry (request);
+  gftp_test_check (request->cachefd > 0);
+  if (request->cachefd <= 0)
+    return;
+
+  for (i = 0; i < num_files; i++)
+    gftp_test_check (gftp_write_cache_file (request, &files[i]) > 0);
+
+  close (request->cachefd);
+  request->cachefd = -1;
+  gftp_finish_cache_entry (request, commit);
+}
+
+
+static int
+same_string (const char *str1, const char *str2)
+{
+  if (str1 == NULL || str2 == NULL)
+    return (str1 == str2);
+
+  return (strcmp (str1, str2) == 0);
+}
+
+
+static void
+test_round_trip (void)
+{
+  gftp_request * request;
+  gftp_file files[3], fle;
+  int cachefd, i;
+
+  memset (files, 0, sizeof (files));
+  files[0].file = "README";
+  files[0].user = "ftp";
+  files[0].group = "ftp";
+  files[0].datetime = 1000000000;
+  files[0].size = 1234;
+  files[0].st_mode = S_IFREG | 0644;
+
+  /* No owner, and a name that is already UTF-8 */
+  files[1].file = "pub";
+  files[1].datetime = 0;
+  files[1].size = 4096;
+  files[1].st_mode = S_IFDIR | 0755;
+  files[1].filename_utf8_encoded = 1;
+
+  /* Bigger than 4 GB, with an empty group */
+  files[2].file = "debian.iso";
+  files[2].user = "root";
+  files[2].group = "";
+  files[2].datetime = 2000000000;
+  files[2].size = (off_t) 5 * 1024 * 1024 * 1024;
+  files[2].st_mode = S_IFREG | 0600;
+
+  request = new_cache_request ("/pub");
+  write_listing (request, files, 3, 1);
+
+  cachefd = gftp_find_cache_entry (request);
+  gftp_test_check (cachefd > 0);
+  if (cachefd <= 0)
+    {
+      gftp_request_destroy (request, 1);
+      return;
+    }
+
+  for (i = 0; i < 3; i++)
+    {
+      memset (&fle, 0, sizeof (fle));
+      gftp_test_check (gftp_read_cache_file (request, &fle) > 0);
+      gftp_test_check (same_string (fle.file, files[i].file));
+      gftp_test_check (same_string (fle.user, files[i].user));
+      gftp_test_check (same_string (fle.group, files[i].group));
+      gftp_test_check (fle.datetime == files[i].datetime);
+      gftp_test_check (fle.size == files[i].size);
+      gftp_test_check (fle.st_mode == files[i].st_mode);
+      gftp_test_check (fle.filename_utf8_encoded ==
+                       files[i].filename_utf8_encoded);
+      gftp_file_destroy (&fle, 0);
+    }
+
+  gftp_test_check (gftp_read_cache_file (request, &fle) == 0);
+
+  /* A record that was cut short is reported instead of read past the end
+     of the entry */
+  request->cachemap_pos = request->cachemap_len - 3;
+  gftp_test_check (gftp_read_cache_file (request, &fle) == GFTP_EFATAL);
+
+  gftp_release_cache_entry (request);
+  close (cachefd);
+  gftp_request_destroy (request, 1);
+}
+
+
+static void
+test_other_entries (void)
+{
+  gftp_request * request;
+  gftp_file fle;
+
+  memset (&fle, 0, sizeof (fle));
+  fle.file = "upload.txt";
+  fle.size = 10;
+  fle.st_mode = S_IFREG | 0644;
+
+  /* A listing that was not finished is thrown away */
+  request = new_cache_request ("/incoming");
+  write_listing (request, &fle, 1, 0);
+  gftp_test_check (gftp_find_cache_entry (request) == -1);
+  gftp_request_destroy (request, 1);
+
+  /* The same directory on another host has its own entry */
+  request = new_cache_request ("/pub");
+  g_free (request->hostname);
+  request->hostname = g_strdup ("ftp.example.com");
+  gftp_test_check (gftp_find_cache_entry (request) == -1);
+  gftp_request_destroy (request, 1);
+}
+
+
+static void
+test_expired (void)
+{
+  gftp_request * request;
+  gftp_file fle;
+
+  memset (&fle, 0, sizeof (fle));
+  fle.file = "old.txt";
+  fle.size = 10;
+  fle.st_mode = S_IFREG | 0644;
+
+  /* Runs after the other tests, the first entry that is written trims the
+     entries that expired already */
+  request = new_cache_request ("/old");
+  gftp_set_request_option (request, "cache_ttl", GINT_TO_POINTER (-1));
+  write_listing (request, &fle, 1, 1);
+  gftp_test_check (gftp_find_cache_entry (request) == -1);
+  gftp_request_destroy (request, 1);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  char tempdir[] = "/tmp/gftp-test-cache.XXXXXX", *cachedir;
+
+  gftp_test_init_options ();
+
+  if (mkdtemp (tempdir) == NULL)
+    {
+      perror ("mkdtemp");
+      return (EXIT_FAILURE);
+    }
+  BASE_CONF_DIR = tempdir;
+
+  test_round_trip ();
+  test_other_entries ();
+  test_expired ();
+
+  gftp_clear_cache_files ();
+  cachedir = g_strconcat (tempdir, "/cache", NULL);
+  rmdir (cachedir);
+  g_free (cachedir);
+  rmdir (tempdir);
+
+  return (gftp_test_result ());
+}
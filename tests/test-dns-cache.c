@@ -0,0 +1,155 @@
+/***********************************************************************************/
+/*  test-dns-cache.c - tests for the DNS cache                                     */
+/*  Copyright (C) 1998-2007 Brian Masney <masneyb@gftp.org>                        */
+/*                                                                                 */
+/*  Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/*  of this software and associated documentation files (the "Software"), to deal  */
+/*  in the Software without restriction, including without limitation the rights   */
+/*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/*  copies of the Software, and to permit persons to whom the Software is          */
+/*  furnished to do so, subject to the following conditions:                       */
+/*                                                                                 */
+/*  The above copyright notice and this permission notice shall be included in all */
+/*  copies or substantial portions of the Software.                                */
+/*                                                                                 */
+/*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/*  SOFTWARE.                                                                      */
+/***********************************************************************************/
+
+#include "gftp-test.h"
+
+/* The DNS cache is static, so the connection code is built into the
+   test */
+#include "../lib/socket-connect.c"
+
+#define TTL ((gint64) GFTP_DNS_CACHE_TTL * G_USEC_PER_SEC)
+
+static struct addrinfo *
+new_addrs (int port)
+{
+  struct sockaddr_in addr;
+  struct addrinfo addri;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons (port);
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+  memset (&addri, 0, sizeof (addri));
+  addri.ai_family = AF_INET;
+  addri.ai_socktype = SOCK_STREAM;
+  addri.ai_addr = (struct sockaddr *) &addr;
+  addri.ai_addrlen = sizeof (addr);
+  addri.ai_canonname = "localhost";
+
+  return (copy_addrinfo (&addri));
+}
+
+
+static void
+store (const char *key, int port, gint64 now)
+{
+  struct addrinfo * addrs;
+
+  addrs = new_addrs (port);
+  dns_cache_store (key, addrs, now);
+  free_addrinfo (addrs);
+}
+
+
+/* Returns the port that is cached for key, or 0 on a miss */
+static int
+cached_port (const char *key, gint64 now)
+{
+  struct addrinfo * addrs;
+  int port;
+
+  if ((addrs = dns_cache_lookup (key, now)) == NULL)
+    return (0);
+
+  gftp_test_check (addrs->ai_next == NULL);
+  gftp_test_check (addrs->ai_canonname != NULL &&
+                   strcmp (addrs->ai_canonname, "localhost") == 0);
+  port = w_sockaddr_get_port (addrs->ai_addr);
+  free_addrinfo (addrs);
+  return (port);
+}
+
+
+static void
+test_ttl (void)
+{
+  gint64 now = (gint64) 1000 * G_USEC_PER_SEC;
+
+  gftp_test_check (cached_port ("example.org/21/0/1", now) == 0);
+
+  store ("example.org/21/0/1", 21, now);
+  gftp_test_check (cached_port ("example.org/21/0/1", now) == 21);
+  gftp_test_check (cached_port ("example.org/21/0/1", now + TTL - 1) == 21);
+  gftp_test_check (cached_port ("example.org/21/0/1", now + TTL) == 0);
+  gftp_test_check (cached_port ("example.org/22/0/1", now) == 0);
+
+  /* Looking the host up again starts the TTL over */
+  store ("example.org/21/0/1", 2121, now + TTL);
+  gftp_test_check (cached_port ("example.org/21/0/1", now + TTL) == 2121);
+  gftp_test_check (cached_port ("example.org/21/0/1", now + 2 * TTL - 1) == 2121);
+
+  /* A host that could not be connected to is looked up again */
+  dns_cache_forget ("example.org/21/0/1");
+  gftp_test_check (cached_port ("example.org/21/0/1", now + TTL) == 0);
+  dns_cache_forget ("example.org/21/0/1");
+}
+
+
+static void
+test_eviction (void)
+{
+  gint64 now = (gint64) 5000 * G_USEC_PER_SEC;
+  char key[32];
+  int i;
+
+  g_hash_table_remove_all (gftp_dns_cache);
+
+  /* Half of the entries expire before the cache fills up */
+  for (i = 0; i < GFTP_DNS_CACHE_MAX; i++)
+    {
+      snprintf (key, sizeof (key), "host%d/21/0/1", i);
+      store (key, i + 1, i < GFTP_DNS_CACHE_MAX / 2 ? now : now + TTL / 2);
+    }
+  gftp_test_check (g_hash_table_size (gftp_dns_cache) == GFTP_DNS_CACHE_MAX);
+
+  store ("new/21/0/1", 1, now + TTL);
+  gftp_test_check (g_hash_table_size (gftp_dns_cache) ==
+                   GFTP_DNS_CACHE_MAX / 2 + 1);
+  gftp_test_check (g_hash_table_lookup (gftp_dns_cache, "host0/21/0/1") == NULL);
+  gftp_test_check (cached_port ("host63/21/0/1", now + TTL) == 64);
+  gftp_test_check (cached_port ("new/21/0/1", now + TTL) == 1);
+
+  /* None of the entries expired, the cache still doesn't grow past its
+     limit */
+  for (i = 0; g_hash_table_size (gftp_dns_cache) < GFTP_DNS_CACHE_MAX; i++)
+    {
+      snprintf (key, sizeof (key), "other%d/21/0/1", i);
+      store (key, i + 1, now + TTL);
+    }
+
+  store ("last/21/0/1", 1, now + TTL);
+  gftp_test_check (g_hash_table_size (gftp_dns_cache) <= GFTP_DNS_CACHE_MAX);
+  gftp_test_check (cached_port ("last/21/0/1", now + TTL) == 1);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  test_ttl ();
+  test_eviction ();
+
+  g_hash_table_destroy (gftp_dns_cache);
+  return (gftp_test_result ());
+}
@@ -0,0 +1,281 @@
+/***********************************************************************************/
+/*  test-ftp-ascii.c - tests for the ASCII transfer conversion                     */
+/*  Copyright (C) 1998-2007 Brian Masney <masneyb@gftp.org>                        */
+/*                                                                                 */
+/*  Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/*  of this software and associated documentation files (the "Software"), to deal  */
+/*  in the Software without restriction, including without limitation the rights   */
+/*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/*  copies of the Software, and to permit persons to whom the Software is          */
+/*  furnished to do so, subject to the following conditions:                       */
+/*                                                                                 */
+/*  The above copyright notice and this permission notice shall be included in all */
+/*  copies or substantial portions of the Software.                                */
+/*                                                                                 */
+/*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/*  SOFTWARE.                                                                      */
+/***********************************************************************************/
+
+#include "gftp-test.h"
+
+/* The conversion is static, so the protocol is built into the test */
+#include "../lib/protocol_ftp.c"
+
+/* The data connection: each read returns at most the rest of the current
+   block, the writes are collected in output */
+static const char **blocks;
+static size_t block_pos;
+static GString * output;
+
+static ssize_t
+test_read (gftp_request * request, void *ptr, size_t size, int fd)
+{
+  size_t len;
+
+  if (*blocks == NULL)
+    return (0);
+
+  len = strlen (*blocks) - block_pos;
+  if (len > size)
+    len = size;
+
+  memcpy (ptr, *blocks + block_pos, len);
+  block_pos += len;
+  if ((*blocks)[block_pos] == '\0')
+    {
+      blocks++;
+      block_pos = 0;
+    }
+
+  return (len);
+}
+
+
+static ssize_t
+test_write (gftp_request * request, const char *ptr, size_t size, int fd)
+{
+  g_string_append_len (output, ptr, size);
+  return (size);
+}
+
+
+static gftp_request *
+new_ascii_request (void)
+{
+  ftp_protocol_data * ftpdat;
+  gftp_request * request;
+
+  request = gftp_test_request_new ();
+  ftpdat = g_malloc0 (sizeof (*ftpdat));
+  ftpdat->is_ascii_transfer = 1;
+  ftpdat->data_conn_read = test_read;
+  ftpdat->data_conn_write = test_write;
+  ftpdat->data_connection = -1;
+  request->protocol_data = ftpdat;
+  return (request);
+}
+
+
+/* Downloads the blocks, size bytes at a time, and returns what would be
+   written to the local file */
+static char *
+download (const char **data, size_t size)
+{
+  gftp_request * request;
+  char buf[64];
+  ssize_t ret;
+
+  blocks = data;
+  block_pos = 0;
+  output = g_string_new (NULL);
+
+  request = new_ascii_request ();
+  while ((ret = ftp_get_next_file_chunk (request, buf, size)) > 0)
+    g_string_append_len (output, buf, ret);
+  gftp_test_check (ret == 0);
+  gftp_request_destroy (request, 1);
+
+  return (g_string_free (output, FALSE));
+}
+
+
+/* Uploads the blocks and returns what was sent over the data
+   connection */
+static char *
+upload (const char **data)
+{
+  gftp_request * request;
+  size_t len;
+
+  output = g_string_new (NULL);
+
+  request = new_ascii_request ();
+  for (; *data != NULL; data++)
+    {
+      len = strlen (*data);
+      gftp_test_check (ftp_put_next_file_chunk (request, (char *) *data, len)
+                       == (ssize_t) len);
+    }
+  gftp_request_destroy (request, 1);
+
+  return (g_string_free (output, FALSE));
+}
+
+
+static void
+check_download (const char **data, size_t size, const char *expected)
+{
+  char *result;
+
+  result = download (data, size);
+  gftp_test_check (strcmp (result, expected) == 0);
+  g_free (result);
+}
+
+
+static void
+check_upload (const char **data, const char *expected)
+{
+  char *result;
+
+  result = upload (data);
+  gftp_test_check (strcmp (result, expected) == 0);
+  g_free (result);
+}
+
+
+/* Splits str in two at every position, and reads it through buffers of
+   every size */
+static void
+check_download_splits (const char *str, const char *expected)
+{
+  const char *data[3];
+  char *first;
+  size_t i, size;
+
+  for (i = 0; i <= strlen (str); i++)
+    {
+      first = g_strndup (str, i);
+      data[0] = first;
+      data[1] = str + i;
+      data[2] = NULL;
+      for (size = 2; size <= strlen (str) + 1; size++)
+        check_download (*first == '\0' ? data + 1 : data, size, expected);
+      g_free (first);
+    }
+}
+
+
+static void
+check_upload_splits (const char *str, const char *expected)
+{
+  const char *data[3];
+  char *first;
+  size_t i;
+
+  for (i = 0; i <= strlen (str); i++)
+    {
+      first = g_strndup (str, i);
+      data[0] = first;
+      data[1] = str + i;
+      data[2] = NULL;
+      check_upload (data, expected);
+      g_free (first);
+    }
+}
+
+
+static void
+test_from_crlf (void)
+{
+  ftp_protocol_data ftpdat;
+  char buf[16];
+
+  memset (&ftpdat, 0, sizeof (ftpdat));
+
+  strcpy (buf, "a\r\nb\r\n");
+  gftp_test_check (ftp_ascii_from_crlf (&ftpdat, buf, 6) == 4);
+  gftp_test_check (memcmp (buf, "a\nb\n", 4) == 0);
+  gftp_test_check (!ftpdat.ascii_cr_pending);
+
+  /* A lone CR is kept */
+  strcpy (buf, "a\rb\r\r\n");
+  gftp_test_check (ftp_ascii_from_crlf (&ftpdat, buf, 6) == 5);
+  gftp_test_check (memcmp (buf, "a\rb\r\n", 5) == 0);
+  gftp_test_check (!ftpdat.ascii_cr_pending);
+
+  /* A CR at the end waits for the next chunk */
+  strcpy (buf, "ab\r");
+  gftp_test_check (ftp_ascii_from_crlf (&ftpdat, buf, 3) == 2);
+  gftp_test_check (ftpdat.ascii_cr_pending);
+}
+
+
+static void
+test_to_crlf (void)
+{
+  ftp_protocol_data ftpdat;
+  char buf[16];
+
+  memset (&ftpdat, 0, sizeof (ftpdat));
+
+  gftp_test_check (ftp_ascii_to_crlf (&ftpdat, "a\nb\r\n", 5, buf) == 6);
+  gftp_test_check (memcmp (buf, "a\r\nb\r\n", 6) == 0);
+  gftp_test_check (ftpdat.ascii_last == '\n');
+
+  /* The previous chunk ended with the CR of this LF */
+  gftp_test_check (ftp_ascii_to_crlf (&ftpdat, "x\r", 2, buf) == 2);
+  gftp_test_check (ftp_ascii_to_crlf (&ftpdat, "\ny", 2, buf) == 2);
+  gftp_test_check (memcmp (buf, "\ny", 2) == 0);
+
+  gftp_test_check (ftp_ascii_to_crlf (&ftpdat, "\n", 1, buf) == 2);
+  gftp_test_check (memcmp (buf, "\r\n", 2) == 0);
+}
+
+
+static void
+test_download (void)
+{
+  const char *split_cr[] = { "line1\r", "\nline2\r\n", "x\r", NULL };
+  const char *lone_cr[] = { "a\r", "b", NULL };
+  const char *only_cr[] = { "\r", "\r", "\n", NULL };
+
+  check_download (split_cr, 64, "line1\nline2\nx\r");
+  check_download (split_cr, 2, "line1\nline2\nx\r");
+  check_download (lone_cr, 64, "a\rb");
+  check_download (only_cr, 64, "\r\n");
+
+  check_download_splits ("line1\r\nline2\r\n\r\nend", "line1\nline2\n\nend");
+  check_download_splits ("a\rb\r\r\nc\r", "a\rb\r\nc\r");
+  check_download_splits ("no line ends", "no line ends");
+}
+
+
+static void
+test_upload (void)
+{
+  const char *split_crlf[] = { "line1\r", "\nline2\n", NULL };
+
+  check_upload (split_crlf, "line1\r\nline2\r\n");
+
+  check_upload_splits ("line1\nline2\r\n\nend", "line1\r\nline2\r\n\r\nend");
+  check_upload_splits ("a\rb\n", "a\rb\r\n");
+  check_upload_splits ("no line ends", "no line ends");
+}
+
+
+int
+main (int argc, char **argv)
+{
+  test_from_crlf ();
+  test_to_crlf ();
+  test_download ();
+  test_upload ();
+
+  return (gftp_test_result ());
+}
@@ -0,0 +1,196 @@
+/***********************************************************************************/
+/*  test-http-chunk.c - tests for the chunked HTTP decoder                         */
+/*  Copyright (C) 1998-2007 Brian Masney <masneyb@gftp.org>                        */
+/*                                                                                 */
+/*  Permission is hereby granted, free of charge, to any person obtaining a copy   */
+/*  of this software and associated documentation files (the "Software"), to deal  */
+/*  in the Software without restriction, including without limitation the rights   */
+/*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell      */
+/*  copies of the Software, and to permit persons to whom the Software is          */
+/*  furnished to do so, subject to the following conditions:                       */
+/*                                                                                 */
+/*  The above copyright notice and this permission notice shall be included in all */
+/*  copies or substantial portions of the Software.                                */
+/*                                                                                 */
+/*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR     */
+/*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,       */
+/*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    */
+/*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER         */
+/*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,  */
+/*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE  */
+/*  SOFTWARE.                                                                      */
+/***********************************************************************************/
+
+#include "gftp-test.h"
+
+/* The chunk decoder is static, so the protocol is built into the test */
+#include "../lib/protocol_http.c"
+
+static const char *input;
+static size_t input_len, input_pos, input_step;
+
+/* Stands in for the socket, returning at most input_step bytes of input
+   at a time */
+static ssize_t
+test_read (gftp_request * request, void *ptr, size_t size, int fd)
+{
+  size_t len;
+
+  len = input_len - input_pos;
+  if (len > size)
+    len = size;
+  if (len > input_step)
+    len = input_step;
+
+  memcpy (ptr, input + input_pos, len);
+  input_pos += len;
+  return (len);
+}
+
+
+/* Decodes body, step bytes per read. Returns the payload, or NULL on an
+   error. left is set to the number of bytes after the end of the body that
+   were not handed to the caller */
+static char *
+decode (const char *body, size_t step, size_t * left)
+{
+  http_protocol_data * httpdat;
+  gftp_request * request;
+  char buf[8], *payload;
+  size_t payload_len;
+  ssize_t ret;
+
+  input = body;
+  input_len = strlen (body);
+  input_pos = 0;
+  input_step = step;
+
+  request = gftp_test_request_new ();
+  httpdat = g_malloc0 (sizeof (*httpdat));
+  httpdat->real_read_function = test_read;
+  httpdat->chunked_transfer = 1;
+  httpdat->chunk_state = HTTP_CHUNK_SIZE;
+  request->protocol_data = httpdat;
+
+  payload = g_malloc0 (input_len + 1);
+  payload_len = 0;
+  while ((ret = http_chunked_read (request, buf, sizeof (buf), -1)) > 0)
+    {
+      memcpy (payload + payload_len, buf, ret);
+      payload_len += ret;
+    }
+
+  if (ret < 0 || httpdat->chunk_state != HTTP_CHUNK_DONE)
+    {
+      g_free (payload);
+      payload = NULL;
+    }
+  else if (left != NULL)
+    *left = httpdat->raw_len - httpdat->raw_pos + input_len - input_pos;
+
+  gftp_request_destroy (request, 1);
+  return (payload);
+}
+
+
+/* Checks that every read size gives the same payload */
+static void
+check_body (const char *body, const char *expected, size_t expected_left)
+{
+  size_t step, left;
+  char *payload;
+
+  for (step = 1; step <= strlen (body); step++)
+    {
+      left = (size_t) -1;
+      payload = decode (body, step, &left);
+      gftp_test_check (payload != NULL);
+      if (payload == NULL)
+        continue;
+
+      gftp_test_check (strcmp (payload, expected) == 0);
+      gftp_test_check (left == expected_left);
+      g_free (payload);
+    }
+}
+
+
+static void
+check_error (const char *body)
+{
+  size_t step;
+
+  for (step = 1; step <= strlen (body); step++)
+    gftp_test_check (decode (body, step, NULL) == NULL);
+}
+
+
+static void
+test_chunks (void)
+{
+  check_body ("5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n", "hello world", 0);
+
+  /* Reading one byte at a time splits the size line */
+  check_body ("1a\r\nabcdefghijklmnopqrstuvwxyz\r\n0\r\n\r\n",
+              "abcdefghijklmnopqrstuvwxyz", 0);
+  check_body ("A\r\n0123456789\r\n0000\r\n\r\n", "0123456789", 0);
+
+  /* Some servers end the lines with a bare LF */
+  check_body ("5\nhello\n0\n\n", "hello", 0);
+
+  check_body ("0\r\n\r\n", "", 0);
+}
+
+
+static void
+test_extensions (void)
+{
+  check_body ("5;name=value\r\nhello\r\n0;last\r\n\r\n", "hello", 0);
+  check_body ("5 ;name=\"a b\"\r\nhello\r\n0\t;x\r\n\r\n", "hello", 0);
+}
+
+
+static void
+test_trailers (void)
+{
+  check_body ("5\r\nhello\r\n0\r\nExpires: never\r\nX-Empty:\r\n\r\n",
+              "hello", 0);
+
+  /* The next response on the connection is left alone */
+  check_body ("5\r\nhello\r\n0\r\nX-Trailer: 1\r\n\r\nHTTP/1.1 200 OK\r\n",
+              "hello", 17);
+}
+
+
+static void
+test_errors (void)
+{
+  /* Bigger than off_t */
+  check_error ("fffffffffffffffff\r\nhello\r\n0\r\n\r\n");
+  check_error ("10000000000000000000\r\n");
+
+  check_error ("\r\nhello\r\n0\r\n\r\n");
+  check_error (";ext\r\nhello\r\n0\r\n\r\n");
+  check_error ("5x\r\nhello\r\n0\r\n\r\n");
+  check_error ("5\rhello\r\n0\r\n\r\n");
+
+  /* The payload is longer than the chunk size */
+  check_error ("5\r\nhello!\r\n0\r\n\r\n");
+
+  /* The connection closed before the end of the body */
+  check_error ("5\r\nhel");
+  check_error ("5\r\nhello\r\n");
+  check_error ("5\r\nhello\r\n0\r\n");
+}
+
+
+int
+main (int argc, char **argv)
+{
+  test_chunks ();
+  test_extensions ();
+  test_trailers ();
+  test_errors ();
+
+  return (gftp_test_result ());
+}